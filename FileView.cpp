@@ -0,0 +1,134 @@
+#include <fstream>
+#include <cstring>
+#include "FileView.h"
+#include "Except.h"
+
+#ifdef _WIN32
+
+FileView::FileView(const string& filename) : m_filename(filename)
+{
+    ifstream inf(filename, ios::binary);
+    CHECK(inf.good(), "Failed reading file `" << filename << "`");
+    inf.seekg(0, ios_base::end);
+    m_buf.resize((size_t)inf.tellg());
+    inf.seekg(0);
+    inf.read((char*)m_buf.data(), m_buf.size());
+    CHECK(inf.good() || m_buf.empty(), "Failed reading file `" << filename << "`");
+    m_data = m_buf.data();
+    m_size = m_buf.size();
+}
+
+FileView::~FileView()
+{}
+
+// the data was read to memory so writing over the same file is not a problem
+bool FileView::isSameFile(const string& filename) const {
+    return false;
+}
+
+void FileView::writeWithRanges(const string& filename, const string& buf, const vector<CopyRange>& ranges) const
+{
+    ofstream outf(filename, ios::binary);
+    CHECK(outf.good(), "Failed opening file `" << filename << "`");
+    size_t bufPos = 0;
+    for(const auto& r: ranges) {
+        outf.write(buf.data() + bufPos, r.bufOffset - bufPos);
+        outf.write(m_data + r.srcOffset, r.size);
+        bufPos = r.bufOffset;
+    }
+    outf.write(buf.data() + bufPos, buf.size() - bufPos);
+    CHECK(outf.good(), "Failed writing file `" << filename << "`");
+}
+
+#else // posix
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+FileView::FileView(const string& filename) : m_filename(filename)
+{
+    m_fd = open(filename.c_str(), O_RDONLY);
+    CHECK(m_fd != -1, "Failed reading file `" << filename << "`");
+    struct stat st;
+    CHECK(fstat(m_fd, &st) == 0, "Failed reading file `" << filename << "`");
+    m_size = (size_t)st.st_size;
+    m_dev = st.st_dev;
+    m_ino = st.st_ino;
+    if (m_size > 0) {
+        void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        CHECK(p != MAP_FAILED, "Failed mapping file `" << filename << "`");
+        m_data = (const char*)p;
+    }
+}
+
+FileView::~FileView()
+{
+    if (m_data != nullptr)
+        munmap((void*)m_data, m_size);
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool FileView::isSameFile(const string& filename) const {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    return (unsigned long long)st.st_dev == m_dev && (unsigned long long)st.st_ino == m_ino;
+}
+
+static void writeAll(int fd, const char* data, size_t size, const string& filename)
+{
+    while (size > 0) {
+        ssize_t w = write(fd, data, size);
+        if (w < 0 && errno == EINTR)
+            continue;
+        CHECK(w > 0, "Failed writing file `" << filename << "`");
+        data += w;
+        size -= (size_t)w;
+    }
+}
+
+void FileView::writeWithRanges(const string& filename, const string& buf, const vector<CopyRange>& ranges) const
+{
+    CHECK(!isSameFile(filename), "Can't write over the file that is being copied from `" << filename << "`");
+    int outfd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(outfd != -1, "Failed opening file `" << filename << "`");
+    try {
+        size_t bufPos = 0;
+#ifdef __linux__
+        bool kernelCopy = true;
+#endif
+        for(const auto& r: ranges) {
+            writeAll(outfd, buf.data() + bufPos, r.bufOffset - bufPos, filename);
+            bufPos = r.bufOffset;
+
+            size_t done = 0;
+#ifdef __linux__
+            // falls back to a plain write when the file systems don't support it
+            loff_t srcOffset = (loff_t)r.srcOffset;
+            while (kernelCopy && done < r.size) {
+                ssize_t c = copy_file_range(m_fd, &srcOffset, outfd, nullptr, r.size - done, 0);
+                if (c < 0 && errno == EINTR)
+                    continue;
+                if (c <= 0) {
+                    kernelCopy = false;
+                    break;
+                }
+                done += (size_t)c;
+            }
+#endif
+            writeAll(outfd, m_data + r.srcOffset + done, r.size - done, filename);
+        }
+        writeAll(outfd, buf.data() + bufPos, buf.size() - bufPos, filename);
+    }
+    catch(...) {
+        close(outfd);
+        throw;
+    }
+    CHECK(close(outfd) == 0, "Failed writing file `" << filename << "`");
+}
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <istream>
+
+using namespace std;
+
+// a range of bytes that is copied as is from the source file instead of being serialized
+struct CopyRange {
+    size_t bufOffset; // where in the serialized buffer these bytes go
+    size_t srcOffset;
+    size_t size;
+};
+
+// read only view of an entire file. mmap on posix, read to memory on windows
+class FileView
+{
+public:
+    FileView(const string& filename);
+    ~FileView();
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const char* data() const {
+        return m_data;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    // is the given path this same file (a hard link or a different path to it counts as the same)
+    bool isSameFile(const string& filename) const;
+
+    // write buf to a file, with the ranges from this file inserted into it. on linux the ranges are
+    // copied by the kernel with copy_file_range without passing through user memory
+    void writeWithRanges(const string& filename, const string& buf, const vector<CopyRange>& ranges) const;
+
+private:
+    string m_filename;
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    string m_buf;
+#else
+    int m_fd = -1;
+    unsigned long long m_dev = 0, m_ino = 0;
+#endif
+};
+
+// istream over memory that is not copied, for parsing directly from a FileView
+class MemStreamBuf : public streambuf
+{
+public:
+    MemStreamBuf(const char* data, size_t size) {
+        char* p = const_cast<char*>(data);
+        setg(p, p, p + size);
+    }
+protected:
+    pos_type seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode) override {
+        char* target = nullptr;
+        if (dir == ios_base::beg)
+            target = eback() + off;
+        else if (dir == ios_base::cur)
+            target = gptr() + off;
+        else
+            target = egptr() + off;
+        if (target < eback() || target > egptr())
+            return pos_type(off_type(-1));
+        setg(eback(), target, egptr());
+        return pos_type(target - eback());
+    }
+    pos_type seekpos(pos_type pos, ios_base::openmode which) override {
+        return seekoff(off_type(pos), ios_base::beg, which);
+    }
+};
+
+class MemIStream : public istream
+{
+public:
+    MemIStream(const char* data, size_t size) : istream(nullptr), m_buf(data, size) {
+        rdbuf(&m_buf);
+    }
+private:
+    MemStreamBuf m_buf;
+};
@@ -36,9 +36,14 @@ public:
     virtual const char* getMessages() const = 0;
     virtual void getStats(int *numVtx, int *sizeBytes) = 0;
     virtual void runProc(const std::string& name) = 0;
+    // run several procs in the given order as a single pass over the vertices. the result is the same as calling runProc() for each
+    virtual void runProcs(const std::vector<std::string>& names) = 0;
     virtual void setProcEpsilon(float epsilon) = 0; // for 'unify_by_tan_epsilon' proc which needs an epsilon value. use 0.0 to use the default (which is 0.2)
     
     virtual void save(const std::string& filename) = 0;
+    virtual void save(std::ostream& stream) = 0;
+    // the saved mesh is always verified while it is written. true also parses it again after saving, which is slower
+    virtual void setReparseOnSave(bool reparse) = 0;
 
     // call with either &cout or nullptr which is the default
     virtual void setLogOut(std::ostream* out) = 0;
@@ -48,3 +53,38 @@ public:
 
 MESH_ANALYZER_DLL_API IMeshAnalyzer* createMeshAnalyzer(); 
 
+
+// what happened to one mesh of a batch
+struct MeshBatchResult
+{
+    std::string input;  // file name, or the name given with the stream
+    std::string output; // where the result was saved, empty if it was not saved
+    bool ok = false;
+    std::string error;  // when not ok
+    int numVtxBefore = 0, sizeBytesBefore = 0;
+    int numVtxAfter = 0, sizeBytesAfter = 0;
+};
+
+// runs the same procs on many meshes in parallel. the analyzers are reused between meshes
+class MESH_ANALYZER_DLL_API IMeshBatch
+{
+public:
+    virtual ~IMeshBatch() {}
+    virtual void addFile(const std::string& filename) = 0;
+    // the stream is read from a worker thread during run(). name is used for the output file name
+    virtual void addStream(std::istream& stream, const std::string& name) = 0;
+
+    virtual void setProcs(const std::vector<std::string>& names) = 0; // run together like IMeshAnalyzer::runProcs()
+    virtual void setProcEpsilon(float epsilon) = 0;
+    virtual void setOutputDir(const std::string& dir) = 0; // empty doesn't save anything, only gives the stats
+    virtual void setThreads(int numThreads) = 0; // 0 uses the number of cores, which is the default
+    // per file phase timings as JSON lines, and the totals at the end of run(). nullptr, the default, disables it
+    virtual void setProfileOut(std::ostream* out) = 0;
+
+    // process everything that was added. a result for each input in the order they were added,
+    // a mesh that fails doesn't stop the others. the inputs are cleared for the next run
+    virtual const std::vector<MeshBatchResult>& run() = 0;
+};
+
+MESH_ANALYZER_DLL_API IMeshBatch* createMeshBatch();
+
@@ -1,12 +1,21 @@
 #pragma once
 
 #include <iostream>
+#include <cstring>
+#include <utility>
+#include "FileView.h"
+
+// reverse the bytes of every value, in place
+void byteSwap16(void* data, size_t count);
+void byteSwap32(void* data, size_t count);
 
 // wrap an istream
 class Deserializer
 {
 public:
-    Deserializer(istream& ins) : m_in(ins)
+    // swapBuf is given when the file is in the other byte order, ins needs to be a stream over it. values are
+    // swapped when they are read and written back to swapBuf so the bytes kept from the file are native too
+    Deserializer(istream& ins, char* swapBuf = nullptr) : m_in(ins), m_swapBuf(swapBuf)
     {
         m_in.seekg(0, ios_base::end);
         m_filesize = (int)m_in.tellg();
@@ -18,9 +27,23 @@ public:
         T v;
         m_in.read((char*)&v, sizeof(T));
         CHECK(m_in.good(), "failed reading from stream");
+        if (m_swapBuf != nullptr && sizeof(T) > 1) {
+            char* b = (char*)&v;
+            for(size_t i = 0; i < sizeof(T) / 2; ++i)
+                swap(b[i], b[sizeof(T) - 1 - i]);
+            replaceLast(&v, sizeof(T));
+        }
         return v;
     }
 
+    bool swapped() const {
+        return m_swapBuf != nullptr;
+    }
+    // writes back the bytes of the last read after the caller swapped them
+    void replaceLast(const void* buf, size_t size) {
+        memcpy(m_swapBuf + (size_t)m_in.tellg() - size, buf, size);
+    }
+
     ubyte read8() {
         return read<ubyte>();
     }
@@ -37,6 +60,37 @@ public:
         return read<float>();
     }
 
+    // bulk read, fills the entire buffer
+    void readBuf(void* buf, size_t size) {
+        if (size == 0)
+            return;
+        m_in.read((char*)buf, size);
+        CHECK(m_in.good(), "failed reading from stream");
+    }
+    void readBuf(string& buf) {
+        readBuf((void*)buf.data(), buf.size());
+    }
+    // arrays of 2 or 4 byte values
+    void readBuf16(void* buf, size_t count) {
+        readBuf(buf, count * 2);
+        if (swapped() && count > 0) {
+            byteSwap16(buf, count);
+            replaceLast(buf, count * 2);
+        }
+    }
+    void readBuf32(void* buf, size_t count) {
+        readBuf(buf, count * 4);
+        if (swapped() && count > 0) {
+            byteSwap32(buf, count);
+            replaceLast(buf, count * 4);
+        }
+    }
+
+    void skip(int len) {
+        m_in.seekg(len, ios_base::cur);
+        CHECK(m_in.good(), "failed seeking in stream");
+    }
+
     string readStr() {
         string s;
         char c;
@@ -58,6 +112,9 @@ public:
     int consumedChunkLen() { // how many bytes from the current chunk we consumed from the stream
         return (int)m_in.tellg() - m_chunkStart;
     }
+    int chunkStart() const {
+        return m_chunkStart;
+    }
     string consumedBuf() {
         int offset = (int)m_in.tellg();
         m_in.seekg(m_chunkStart);
@@ -91,50 +148,73 @@ public:
 
 private:
     istream& m_in;
+    char* m_swapBuf;
 
     int m_chunkStart = 0;
     int m_filesize = 0;
 };
 
 
-// wrap an ostream for output
+// serializes into a memory buffer, which is written to the output in one go.
+// ranges that are unchanged from the source file are either copied to the buffer or, if ranges
+// is given, only recorded so the output writer can copy them from the file directly
 class Serializer
 {
 public:
-    Serializer(ostream& outs) : m_out(outs)
+    Serializer(string& outbuf, const FileView* source = nullptr, vector<CopyRange>* ranges = nullptr)
+        : m_out(outbuf), m_source(source), m_ranges(ranges)
     {}
 
     void write(const string& s) {
-        if (s.size() == 0)
-            return;
-        m_out.write(s.c_str(), s.size());
+        m_out += s;
+    }
+
+    void write(const void* buf, size_t size) {
+        m_out.append((const char*)buf, size);
     }
 
     void write(uint offset, const string& s) {
         CHECK(s.size() >= offset, "Write negative size");
-        if (s.size() - offset == 0)
-            return;
-        m_out.write(s.c_str() + offset, s.size() - offset);
+        m_out.append(s, offset, string::npos);
     }
 
     void write16(ushort v) {
-        m_out.write((const char*)&v, sizeof(v));
+        write(&v, sizeof(v));
     }
     void write32(uint v) {
-        m_out.write((const char*)&v, sizeof(v));
+        write(&v, sizeof(v));
     }
     void write32f(float v) {
-        m_out.write((const char*)&v, sizeof(v));
+        write(&v, sizeof(v));
     }
     void writeBool(bool bv) {
-        ubyte v = (bv ? 1:0);
-        m_out.put(v);
+        m_out += (char)(bv ? 1:0);
     }
     void writeStr(const string& s) {
         write(s);
-        m_out.put(0x0a);
+        m_out += (char)0x0a;
+    }
+
+    bool canCopy() const {
+        return m_source != nullptr;
+    }
+    void copy(size_t srcOffset, size_t size) {
+        CHECK(m_source != nullptr && srcOffset + size <= m_source->size(), "Copy out of range of the source");
+        if (m_ranges != nullptr)
+            m_ranges->push_back(CopyRange{m_out.size(), srcOffset, size});
+        else
+            m_out.append(m_source->data() + srcOffset, size);
+        m_copied += (m_ranges != nullptr) ? size : 0;
+    }
+
+    // position in the output, including recorded ranges
+    size_t tellp() const {
+        return m_out.size() + m_copied;
     }
 
 private:
-    ostream& m_out;
+    string& m_out;
+    const FileView* m_source;
+    vector<CopyRange>* m_ranges;
+    size_t m_copied = 0; // bytes of recorded ranges, not in m_out
 };
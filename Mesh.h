@@ -4,8 +4,10 @@
 #include <iostream>
 #include <memory>
 #include <set>
+#include <map>
 #include "ogre_types.h"
 #include "helper_types.h"
+#include "FileView.h"
 
 class Chunk;
 
@@ -57,6 +59,7 @@ struct VtxInfo
     Vec3 binormal;
 
     vector<string> selfBufs; // data buffer from the file indexed by the buffer it was in
+    string animKey; // vertex animation and pose data of this vertex, part of the dedup key
     VtxInfo * isDupOf = NULL;
     bool isUsed = true; // for terrain culling
 };
@@ -69,6 +72,69 @@ struct BoneAssign {
 };
 
 
+// data of a M_ANIMATION_MORPH_KEYFRAME chunk
+struct MorphKeyframe {
+    int target;       // 0 for shared geometry, 1+ for submesh index + 1
+    float time;
+    bool hasNormals;
+    vector<float> data; // position (and normal) of every vertex of the target geometry
+    shared_ptr<Chunk> chunk;
+    int floatsPerVtx() const {
+        return hasNormals ? 6 : 3;
+    }
+};
+
+// data of a M_POSE_VERTEX chunk
+struct PoseVertex {
+    uint vertexIndex;
+    Vec3 offset;
+    Vec3 normal;
+    shared_ptr<Chunk> chunk;
+};
+
+// data of a M_POSE chunk
+struct Pose {
+    int target;       // 0 for shared geometry, 1+ for submesh index + 1
+    bool hasNormals;
+    vector<PoseVertex> vtx;
+};
+
+// triangle of a M_EDGE_LIST_LOD chunk, same layout as in the file
+struct EdgeTriangle {
+    uint indexSet;
+    uint vertexSet;
+    uint vertIndex[3];       // in the vertex set
+    uint sharedVertIndex[3]; // in the position welded vertex list, not affected by dedup
+    float normal[4];
+};
+static_assert(sizeof(EdgeTriangle) == 12 * 4, "EdgeTriangle is read directly from the file");
+
+// edge of a M_EDGE_GROUP chunk
+struct EdgeData {
+    uint triIndex[2];
+    uint vertIndex[2];       // in the vertex set of the group
+    uint sharedVertIndex[2];
+    bool degenerate;
+};
+
+// data of a M_EDGE_GROUP chunk
+struct EdgeGroup {
+    uint vertexSet;
+    uint triStart;
+    uint triCount;
+    vector<EdgeData> edges;
+};
+
+// data of a M_EDGE_LIST_LOD chunk and its groups
+struct EdgeListLod {
+    ushort lodIndex;
+    bool isManual;
+    bool isClosed = false;
+    vector<EdgeTriangle> tris;
+    vector<EdgeGroup> groups;
+    shared_ptr<Chunk> chunk;
+};
+
 struct QuadIndex
 {
     int d1, d2, dex1, dex2;
@@ -87,6 +153,8 @@ struct Quad2D
 };
 
 
+#define CHUNK_HEADER_SIZE 6 // ushort id + uint size
+
 // a chunk in the recursive chunk struction of the file
 class Chunk
 {
@@ -99,6 +167,7 @@ public:
 
     // remove this chunk and all its children from the tree (invalidates iterators)
     void detach() {
+        parent->grow(-size);
         parent->detachChild(this);
     }
     void detachChild(Chunk* child) {
@@ -111,6 +180,35 @@ public:
         CHECK(false, "Could not find deleted child");
     }
 
+    // the content of this chunk changed size, update it and all its parents so sizes are always correct
+    void grow(int delta) {
+        if (delta == 0)
+            return;
+        for(Chunk* c = this; c != nullptr; c = c->parent) {
+            c->size += delta;
+            c->dirty = true;
+        }
+    }
+    // the content of this chunk changed so it can't be copied from the source file when saving
+    void touch() {
+        for(Chunk* c = this; c != nullptr; c = c->parent)
+            c->dirty = true;
+    }
+    void touchTree() {
+        touch();
+        for(const auto& c: sub)
+            c->touchTree();
+    }
+    void setSize(int newSize) {
+        grow(newSize - size);
+    }
+    Chunk* child(ushort childId) {
+        for(const auto& c: sub)
+            if (c->id == childId)
+                return c.get();
+        return nullptr;
+    }
+
     ushort id;
     int origSize;      // size from chunk header
     int size;          // fixed size according to consumed data
@@ -119,6 +217,8 @@ public:
     //int remainSize;    // during parse - how many bytes are left
     string selfBuf;
     Chunk* parent;
+    int fileOffset = -1; // of the chunk header in the source file
+    bool dirty = false;  // this chunk or one of its children changed since it was parsed
 };
 
 class SubMesh
@@ -127,10 +227,19 @@ public:
     void dedup(vector<int>* outOldToNew = nullptr);
     void removeField(int sem, int index);
     int dupsExact(int sem = -1, int index = 0);
+    void estimateDups(map<uint, int>* dupsWithout);
     int dupsByVecEpsilon(float epsilon, int vtxFlag); // VF_TANGENT or VF_BINORMAL
     void unifyBuffers();
     bool buffersNeedUnify();
-    void cullFaces(const vector<Vec3>& possibleEyes, SubMesh* sharedGeom);
+    void rewriteBuffers(const vector<pair<int, int>>& removeFields, bool unify);
+    bool canAppend(const SubMesh& other) const;
+    void append(SubMesh& other);
+    void cullFaces(const vector<Vec3>& possibleEyes, SubMesh* sharedGeom, ostream& out);
+    void decodeVertexBuffer(const char* data, size_t size, int bindIndex);
+    void checkDecode(int bindIndex);
+    void setIndices(vector<uint>&& indices);
+    void updateVertexDataSizes();
+    void touchDeclaration();
 
     void clearIsDupOf();
     void clearUsed();
@@ -157,6 +266,26 @@ public:
     vector<uint> m_indices;
     vector<BoneAssign> m_boneAssign;
     bool m_isSharedGeom = false;
+    shared_ptr<Chunk> m_chunk; // the 0x4000 chunk of this submesh, null for the shared geometry
+};
+
+// data of the M_MESH_BOUNDS chunk
+struct MeshBounds {
+    Vec3 min, max;
+    float radius = 0.0f; // of a sphere around the origin
+};
+
+// several optimizations that Mesh::optimize executes together with one pass over the vertex buffers
+struct OptimizePlan {
+    enum DedupFlags {
+        DEDUP_NONE = 0,
+        DEDUP_EXACT = 1,
+        DEDUP_TAN_EPSILON = 2 // submeshes without tangent and binormal are left to DEDUP_EXACT
+    };
+    vector<pair<int, int>> removeFields; // semantic and index of every field to remove
+    uint dedup = DEDUP_NONE;
+    bool unifyBuffers = false;
+    bool mergeSubmeshes = false; // submeshes with the same material become one
 };
 
 class Deserializer;
@@ -174,16 +303,36 @@ public:
 
     int dupsByTanEpsilon(float epsilon);
     int dupsExact(int sem = -1, int index = 0);
+    // duplicate count if the field with the given flag is removed, by key 0 the count with nothing removed
+    map<uint, int> estimateDups();
 
     void dedup();
     void removeField(int sem, int index);
     void unifyBuffers();
     bool buffersNeedUnify();
+    bool canMergeSubmeshes();
+    void mergeSubmeshes();
+    bool isAppendable();
+    void append(Mesh& other);
+    bool getBounds(MeshBounds* b);
+    void setBounds(const MeshBounds& b);
+    void optimize(const OptimizePlan& plan);
 
-    void cullFaces(const vector<Vec3>& possibleEyes);
+    void cullFaces(const vector<Vec3>& possibleEyes, ostream& out);
 
     void save(const string& filename);
     void save(ostream& outfile);
+    // serialize to memory, verifying the counts and declarations as they are written.
+    // with ranges, chunks that did not change since parse are not copied, only recorded in ranges
+    void serialize(string* outbuf, vector<CopyRange>* ranges = nullptr, bool copyUnchanged = true);
+
+    // flat binary image of what parse builds, loaded again without parsing the chunks. it's the memory
+    // layout of this build, a snapshot from a different version or platform is rejected.
+    // parse loads snapshots too so every command takes them instead of .mesh files
+    void saveSnapshot(string* outbuf);
+    void saveSnapshot(const string& filename);
+    void loadSnapshot(const char* data, size_t size);
+    static bool isSnapshot(const char* data, size_t size);
 
     void statline(ostream& out);
     void clear();
@@ -192,25 +341,35 @@ public:
     bool hasBinormal();
     bool hasEdgeList();
     bool hasVertexAnim();
+    bool hasPassThroughVtxRefs();
+    SubMesh* animTargetGeom(int target);
 
     void setEpsilon(float e) {
         m_defaultEpsilon = e;
     }
+    float tanEpsilon(float epsilon);
+
+    // attributes adds normals, texture coordinates and a group per submesh
+    void exportObj(const string& filename, bool attributes = true);
 
-    void exportObj(const string& filename);
+    void checkDecode(); // throws if the fast vertex decoding differs from the reference decoder
 
     int countVtx();
     int countTri();
 
-    bool extractQuads(float height, QuadGrid* grid);
+    bool extractQuads(float height, QuadGrid* grid, ostream& out);
     void replaceQuads(const QuadGrid& grid);
 
-    void removeDupTri();
+    void removeDupTri(ostream& out);
     vector<float> getPlaneHeights() const;
     void clearUsed();
     void markUsedVertices();
 
 private:
+    void buildAnimKeys();
+    void remapVtxAnim(int target, const vector<int>& oldToNew);
+    void remapEdgeLists(const vector<vector<int>>& subOldToNew, const vector<int>& sharedOldToNew);
+    bool buildEdgeList(EdgeListLod* el) const;
     void parseMesh(Deserializer& s, ostream* out, int fileVer);
     void parseSkeleton(Deserializer& s, ostream* out, int fileVer);
 
@@ -221,6 +380,13 @@ public:
     string m_headerBuf;
     set<string> m_materials; // keep track if there is more than one material
     shared_ptr<SubMesh> m_sharedGeom; // if shared geometry exists, this holds it (not all fields of SubMesh used)
+    set<ushort> m_passThroughIds; // ids of chunks that were not parsed and are kept as raw data
+    vector<MorphKeyframe> m_morphKeys; // in file order
+    vector<Pose> m_poses;              // in file order
+    vector<EdgeListLod> m_edgeLists;   // in file order
+    int m_fileVer = 0;
+    bool m_swappedOrder = false; // the file was in the other byte order, it was converted to native when parsed
+    shared_ptr<FileView> m_source; // the file this was parsed from, unchanged chunks are copied from it when saving
 
     bool m_outAllVertices = false; // should parsing output a live for each vertex with its info? (lots of data)
     float m_defaultEpsilon = 0.2f;
@@ -1,5 +1,8 @@
 #include "MeshAnalyzer.h"
 #include "NullStream.h"
+#include "Profile.h"
+#include <fstream>
+#include <sstream>
 
 MESH_ANALYZER_DLL_API IMeshAnalyzer* createMeshAnalyzer() {
     return new MeshAnalyzer();
@@ -16,14 +19,28 @@ void MeshAnalyzer::parse(istream& infile) {
     m_mesh.parse(infile, m_logOut);
 }
 
+// saving to a file copies the chunks that did not change directly from the parsed file
 void MeshAnalyzer::save(const string& filename) {
     m_mesh.save(filename);
-    // verify that the saved mesh can be loaded correctly
-    Mesh rm;
-    rm.parse(filename, m_logOut);
+    if (m_reparseOnSave) {
+        Mesh rm;
+        rm.parse(filename, m_logOut);
+    }
 }
 void MeshAnalyzer::save(ostream& outfile) {
-    m_mesh.save(outfile);
+    string buf;
+    m_mesh.serialize(&buf);
+    outfile.write(buf.data(), buf.size());
+    CHECK(outfile.good(), "Failed writing mesh");
+    if (m_reparseOnSave)
+        reparse(buf);
+}
+
+// verify that the saved mesh can be loaded correctly
+void MeshAnalyzer::reparse(const string& buf) {
+    istringstream inf(buf);
+    Mesh rm;
+    rm.parse(inf, m_logOut);
 }
 
 Mesh* MeshAnalyzer::getMesh() {
@@ -47,11 +64,19 @@ bool Proc::genericCheckVtxDup(uint vflag) {
     // if the mesh doesn't have that flag, abort
     if (!checkFlag(m_mesh->gatheredEntries(), vflag))
         return false;
-    if (m_mesh->hasEdgeList() || m_mesh->hasVertexAnim())
+    if (m_mesh->hasPassThroughVtxRefs())
         return false;
     return true;
 }
 
+int Proc::estimatedDups(uint removedFlag) {
+    CHECK(m_dupEstimate != nullptr, "duplicates not estimated");
+    auto it = m_dupEstimate->find(removedFlag);
+    if (it == m_dupEstimate->end())
+        return 0;
+    return it->second;
+}
+
 
 class UnifyByTanEpsilon : public Proc
 {
@@ -64,8 +89,11 @@ public:
         return "Unify the mesh vertices by almost-identical 'tangent' vector value";
     }
 
+    virtual bool applies() {
+        return genericCheckVtxDup(VF_TANGENT);
+    }
     virtual bool prepare() {
-        if (!genericCheckVtxDup(VF_TANGENT))
+        if (!applies())
             return false;
         m_countDupVtx = m_mesh->dupsByTanEpsilon(0.0); // uses the default		
         return true;
@@ -75,6 +103,9 @@ public:
         m_countDupVtx = m_mesh->dupsByTanEpsilon(0.0);
         m_mesh->dedup();
     }
+    virtual void plan(OptimizePlan* plan) {
+        plan->dedup |= OptimizePlan::DEDUP_TAN_EPSILON;
+    }
 };
 
 class JustUnify : public Proc
@@ -89,15 +120,22 @@ public:
         return "Unify vertices without changing anything else";
     }
 
+    virtual bool applies() {
+        return !m_mesh->hasPassThroughVtxRefs();
+    }
     virtual bool prepare() {
-        m_countDupVtx = m_mesh->dupsExact(-1, 0);
+        if (!applies())
+            return false;
+        m_countDupVtx = estimatedDups(0);
         return true;
     }
     virtual void run() {
         m_countDupVtx = m_mesh->dupsExact();
         m_mesh->dedup();
     }
-
+    virtual void plan(OptimizePlan* plan) {
+        plan->dedup |= OptimizePlan::DEDUP_EXACT;
+    }
 };
 
 class RemoveFieldAndUnify : public Proc
@@ -116,10 +154,13 @@ public:
         return m_desc.c_str();
     }    
 
+    virtual bool applies() {
+        return genericCheckVtxDup(vtxFlagFromSem(m_sem, m_index));
+    }
     virtual bool prepare() {
-        if (!genericCheckVtxDup(vtxFlagFromSem(m_sem, m_index)))
+        if (!applies())
             return false;
-        m_countDupVtx = m_mesh->dupsExact(m_sem, m_index);
+        m_countDupVtx = estimatedDups(vtxFlagFromSem(m_sem, m_index));
         return true;
     }
     virtual void run() {
@@ -127,6 +168,10 @@ public:
         m_countDupVtx = m_mesh->dupsExact();
         m_mesh->dedup();
     }
+    virtual void plan(OptimizePlan* plan) {
+        plan->removeFields.push_back(make_pair(m_sem, m_index));
+        plan->dedup |= OptimizePlan::DEDUP_EXACT;
+    }
 
 private:
     string m_name, m_desc;
@@ -170,7 +215,7 @@ public:
         return "In meshes that have more than a single vertex buffer, merge all bufferes into a single buffer. This has some performance gain.";
     }
 
-    virtual bool prepare() {
+    virtual bool applies() {
         bool needMerge = false;
         for(const auto& s: m_mesh->m_sub) {
             if (s.m_entries.size() > 1)
@@ -178,33 +223,73 @@ public:
         }
         return needMerge;
     }
+    virtual bool prepare() {
+        return applies();
+    }
     virtual void run() {
         m_mesh->unifyBuffers();
     }
+    virtual void plan(OptimizePlan* plan) {
+        plan->unifyBuffers = true;
+    }
+};
+
+class MergeSubmeshes : public Proc
+{
+public:
+    virtual ~MergeSubmeshes() {}
+    virtual const char* getName() const {
+        return "merge_submeshes";
+    }
+    virtual const char* getDescription() const {
+        return "Merge submeshes that have the same material and the same vertex declaration into a single submesh. This saves draw calls.";
+    }
+
+    virtual bool applies() {
+        return m_mesh->canMergeSubmeshes();
+    }
+    virtual bool prepare() {
+        return applies();
+    }
+    virtual void run() {
+        m_mesh->mergeSubmeshes();
+    }
+    virtual void plan(OptimizePlan* plan) {
+        plan->mergeSubmeshes = true;
+    }
 };
 
 
-vector<IProc*>& MeshAnalyzer::analyze()
+MeshAnalyzer::MeshAnalyzer()
 {
-    if (m_procFactory.m_names.empty()) {
 #ifdef MESH_TOOL
-        m_procFactory.add<UnifyByTanEpsilon>();
-        m_procFactory.add<JustUnify>();
+    m_procFactory.add<UnifyByTanEpsilon>();
+    m_procFactory.add<JustUnify>();
 #endif
-        m_procFactory.add<RemoveNormal>();
-        m_procFactory.add<RemoveDiffuse>();
-        m_procFactory.add<RemoveTangent>();
-        m_procFactory.add<RemoveBinormal>();
-        m_procFactory.add<RemoveTex0>();
-        m_procFactory.add<RemoveTex1>();
-        m_procFactory.add<RemoveTex2>();
-        m_procFactory.add<RemoveTex3>();
-        m_procFactory.add<MergeBuffers>();
-    }
+    m_procFactory.add<RemoveNormal>();
+    m_procFactory.add<RemoveDiffuse>();
+    m_procFactory.add<RemoveTangent>();
+    m_procFactory.add<RemoveBinormal>();
+    m_procFactory.add<RemoveTex0>();
+    m_procFactory.add<RemoveTex1>();
+    m_procFactory.add<RemoveTex2>();
+    m_procFactory.add<RemoveTex3>();
+    m_procFactory.add<MergeBuffers>();
+    m_procFactory.add<MergeSubmeshes>();
+}
+
+vector<IProc*>& MeshAnalyzer::analyze()
+{
+    // the analyzer may be reused for another mesh
+    m_procs.clear();
+    m_iprocs.clear();
 
+    // a single pass that estimates the duplicates count for all the procs, by hash and not by the full key
+    m_dupEstimate = m_mesh.estimateDups();
     for(const auto& name: m_procFactory.m_names) {
         shared_ptr<Proc> p( m_procFactory.create(name) );
         p->setMesh(&m_mesh);
+        p->setDupEstimate(&m_dupEstimate);
         if (p->prepare())
             m_procs.push_back(p);
     }
@@ -226,11 +311,8 @@ vector<IProc*>& MeshAnalyzer::analyze()
         ss << "WARNING: Mesh contains more than 1 texture coordinate channel (" << texChans << " channels). Make sure this is ok\n";
     }
     
-    if (m_mesh.hasVertexAnim()) {
-        ss << "WARNING: Mesh contains veretx animation. This will prevent unifying vertices\n";
-    }
-    if (m_mesh.hasEdgeList()) {
-        ss << "WARNING: Mesh has edge-list information. This will prevent unifying vertices\n";
+    if (m_mesh.hasPassThroughVtxRefs()) {
+        ss << "WARNING: Mesh has LOD or shared geometry bone assignment information. This will prevent unifying vertices\n";
     }
 
     m_warnings = ss.str();
@@ -247,6 +329,22 @@ void MeshAnalyzer::runProc(const string& name)
 {
     shared_ptr<Proc> p( m_procFactory.create(name) );
     p->setMesh(&m_mesh);
+    if (!p->applies())
+        return;
+    string phaseName = "proc:" + name;
+    ScopedPhase phase(phaseName.c_str(), m_mesh.m_rootChunk->size);
     p->run();
 }
+void MeshAnalyzer::runProcs(const vector<string>& names)
+{
+    ScopedPhase phase("procs", m_mesh.m_rootChunk->size);
+    OptimizePlan plan;
+    for(const auto& name: names) {
+        shared_ptr<Proc> p( m_procFactory.create(name) );
+        p->setMesh(&m_mesh);
+        if (p->applies())
+            p->plan(&plan);
+    }
+    m_mesh.optimize(plan);
+}
 
@@ -13,19 +13,28 @@ public:
     virtual ~Proc() {}
     virtual void getAfterStats(int *numVtx, int *sizeBytes);
 
-    // returns false if this procedure is not available
+    // returns false if this procedure does not apply to the mesh. cheap, doesn't estimate anything
+    virtual bool applies() = 0;
+    // returns false if this procedure is not available, otherwise estimates what it would do
     virtual bool prepare() = 0;
     virtual void run() = 0;
+    // adds what run() does to a plan that executes several procs together
+    virtual void plan(OptimizePlan* plan) = 0;
 
     void setMesh(Mesh* m) {
         m_mesh = m;
     }
+    void setDupEstimate(const map<uint, int>* e) {
+        m_dupEstimate = e;
+    }
 
 protected:
     bool genericCheckVtxDup(uint vflag);
+    int estimatedDups(uint removedFlag);
 
 protected:
     Mesh* m_mesh = nullptr;
+    const map<uint, int>* m_dupEstimate = nullptr; // from Mesh::estimateDups(), computed once for all procs
     int m_countDupVtx = 0;
 };
 
@@ -51,6 +60,7 @@ public:
 class MeshAnalyzer : public IMeshAnalyzer
 {
 public:
+    MeshAnalyzer();
     virtual ~MeshAnalyzer() {}
     virtual void parse(const string& filename);
     virtual void parse(istream& stream);
@@ -61,16 +71,24 @@ public:
     }
     virtual void getStats(int *numVtx, int *sizeBytes);
     virtual void runProc(const string& name);
+    virtual void runProcs(const vector<string>& names);
     virtual void setProcEpsilon(float epsilon) { 
         m_mesh.setEpsilon(epsilon);
     }
     
     virtual void save(const string& filename);
     virtual void save(ostream& stream);
+    virtual void setReparseOnSave(bool reparse) {
+        m_reparseOnSave = reparse;
+    }
 
     virtual void setLogOut(ostream* out);
 	virtual Mesh* getMesh();
 
+    bool hasProc(const string& name) const {
+        return m_procFactory.m_f.count(name) > 0;
+    }
+
 private:
     vector<shared_ptr<Proc>> m_procs;
     vector<IProc*> m_iprocs;
@@ -78,6 +96,10 @@ private:
     Factory m_procFactory;
 
     Mesh m_mesh;
+    map<uint, int> m_dupEstimate;
     string m_warnings;
     ostream* m_logOut = nullptr;
+    bool m_reparseOnSave = false;
+
+    void reparse(const string& buf);
 };
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "MeshBatch.h"
+#include "WorkQueue.h"
+#include "Profile.h"
+
+MESH_ANALYZER_DLL_API IMeshBatch* createMeshBatch() {
+    return new MeshBatch();
+}
+
+static string outputName(const string& path) {
+    auto lastSlash = path.find_last_of("/\\");
+    if (lastSlash != string::npos)
+        return path.substr(lastSlash + 1);
+    return path;
+}
+
+void MeshBatch::addFile(const string& filename) {
+    Input in;
+    in.filename = filename;
+    in.name = filename;
+    m_inputs.push_back(in);
+}
+void MeshBatch::addStream(istream& stream, const string& name) {
+    Input in;
+    in.stream = &stream;
+    in.name = name;
+    m_inputs.push_back(in);
+}
+
+void MeshBatch::process(const Input& in, MeshAnalyzer* ma, MeshBatchResult* res)
+{
+    res->input = in.name;
+    ScopedProfileOutput profileOutput(&m_profile);
+    ScopedProfileFile profileFile(in.name);
+    try {
+        if (in.stream != nullptr)
+            ma->parse(*in.stream);
+        else
+            ma->parse(in.filename);
+        ma->getStats(&res->numVtxBefore, &res->sizeBytesBefore);
+
+        if (!m_procs.empty()) {
+            ma->setProcEpsilon(m_epsilon);
+            ma->runProcs(m_procs);
+        }
+        ma->getStats(&res->numVtxAfter, &res->sizeBytesAfter);
+
+        if (!m_outdir.empty()) {
+            string outpath = m_outdir;
+            if (outpath.back() != '/' && outpath.back() != '\\')
+                outpath += "/";
+            outpath += outputName(in.name);
+            ma->save(outpath);
+            res->output = outpath;
+        }
+        res->ok = true;
+    }
+    catch(const std::exception& e) {
+        res->error = e.what();
+    }
+}
+
+const vector<MeshBatchResult>& MeshBatch::run()
+{
+    m_results.clear();
+    m_results.resize(m_inputs.size());
+    for(const auto& name: m_procs) {
+        CHECK(MeshAnalyzer().hasProc(name), "Unknown proc " << name);
+    }
+    if (!m_outdir.empty()) {
+        // outputs are named by basename, two inputs with the same one would overwrite each other
+        set<string> outnames;
+        for(const auto& in: m_inputs) {
+            CHECK(outnames.insert(outputName(in.name)).second, "Duplicate output name " << outputName(in.name));
+        }
+    }
+
+    {
+        WorkQueue queue(m_numThreads);
+        while (m_analyzers.size() < (size_t)queue.numThreads())
+            m_analyzers.push_back(make_shared<MeshAnalyzer>());
+        for(size_t i = 0; i < m_inputs.size(); ++i) {
+            queue.push([this, i](int worker) {
+                process(m_inputs[i], m_analyzers[worker].get(), &m_results[i]);
+            });
+        }
+        queue.finish();
+    }
+    // don't keep the last meshes and their source files
+    for(const auto& ma: m_analyzers)
+        ma->getMesh()->clear();
+
+    m_inputs.clear();
+    m_profile.writeTotals();
+    return m_results;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "IMeshAnalyzer.h"
+#include "MeshAnalyzer.h"
+#include "Profile.h"
+
+using namespace std;
+
+class MeshBatch : public IMeshBatch
+{
+public:
+    virtual ~MeshBatch() {}
+    virtual void addFile(const string& filename);
+    virtual void addStream(istream& stream, const string& name);
+
+    virtual void setProcs(const vector<string>& names) {
+        m_procs = names;
+    }
+    virtual void setProcEpsilon(float epsilon) {
+        m_epsilon = epsilon;
+    }
+    virtual void setOutputDir(const string& dir) {
+        m_outdir = dir;
+    }
+    virtual void setThreads(int numThreads) {
+        m_numThreads = numThreads;
+    }
+    virtual void setProfileOut(ostream* out) {
+        m_profile.setStream(out);
+    }
+
+    virtual const vector<MeshBatchResult>& run();
+
+private:
+    struct Input {
+        string filename;
+        istream* stream = nullptr; // instead of the file
+        string name;
+    };
+    void process(const Input& in, MeshAnalyzer* ma, MeshBatchResult* res);
+
+    vector<Input> m_inputs;
+    vector<MeshBatchResult> m_results;
+    vector<string> m_procs;
+    float m_epsilon = 0.0;
+    string m_outdir;
+    int m_numThreads = 0;
+    ProfileOutput m_profile; // used by the workers instead of the default output of Profile
+    // one per worker thread, kept between runs
+    vector<shared_ptr<MeshAnalyzer>> m_analyzers;
+};
@@ -0,0 +1,429 @@
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstring>
+#include <cfloat>
+#include "MeshBuilder.h"
+#include "InputOutput.h"
+#include "ObjReader.h"
+
+// writes nested chunks, the size of a chunk is filled when it ends
+class ChunkWriter
+{
+public:
+    ChunkWriter(string& out) : m_out(out), s(out)
+    {}
+    void begin(ushort id) {
+        m_open.push_back(m_out.size());
+        s.write16(id);
+        s.write32(0);
+    }
+    void end() {
+        size_t start = m_open.back();
+        m_open.pop_back();
+        uint size = (uint)(m_out.size() - start);
+        memcpy(&m_out[start + sizeof(ushort)], &size, sizeof(size));
+    }
+
+private:
+    string& m_out;
+    vector<size_t> m_open;
+public:
+    Serializer s;
+};
+
+// small deterministic generator, the same numbers on every platform
+class Rand
+{
+public:
+    Rand(uint seed) : m_state(seed) {}
+    uint next() {
+        m_state = m_state * 1664525u + 1013904223u;
+        return m_state >> 8;
+    }
+    int range(int n) {
+        return (int)(next() % (uint)n);
+    }
+    float uniform(float a, float b) {
+        return a + (b - a) * (float)(next() & 0xffff) / 65535.0f;
+    }
+private:
+    uint m_state;
+};
+
+struct BuildElement {
+    ushort type;
+    ushort sem;
+    ushort index;
+};
+typedef vector<BuildElement> BuildBind;
+
+// one vertex as floats for every field, written according to the declaration
+struct BuildVertex {
+    float pos[3];
+    float normal[3];
+    float tangent[3];
+    float binormal[3];
+    float uv[2][2];
+    uint color;
+};
+
+static void writeHeader(ChunkWriter& w)
+{
+    w.s.write16(0x1000);
+    w.s.writeStr("[MeshSerializer_v1.8]");
+}
+
+static void writeField(Serializer& s, const BuildVertex& v, const BuildElement& e)
+{
+    const float* f = nullptr;
+    switch (e.sem) {
+    case VES_POSITION: f = v.pos; break;
+    case VES_NORMAL: f = v.normal; break;
+    case VES_TANGENT: f = v.tangent; break;
+    case VES_BINORMAL: f = v.binormal; break;
+    case VES_TEXTURE_COORDINATES: f = v.uv[e.index]; break;
+    case VES_DIFFUSE:
+        s.write32(v.color);
+        return;
+    }
+    CHECK(f != nullptr, "Unsupported semantic in builder");
+    s.write(f, typeSize(e.type));
+}
+
+static void writeGeometry(ChunkWriter& w, const vector<BuildVertex>& vtx, const vector<BuildBind>& binds)
+{
+    w.begin(0x5000); // M_GEOMETRY
+    w.s.write32((uint)vtx.size());
+
+    w.begin(0x5100); // M_GEOMETRY_VERTEX_DECLARATION
+    for(size_t bi = 0; bi < binds.size(); ++bi) {
+        ushort offset = 0;
+        for(const auto& e: binds[bi]) {
+            w.begin(0x5110); // M_GEOMETRY_VERTEX_ELEMENT
+            w.s.write16((ushort)bi);
+            w.s.write16(e.type);
+            w.s.write16(e.sem);
+            w.s.write16(offset);
+            w.s.write16(e.index);
+            w.end();
+            offset += typeSize(e.type);
+        }
+    }
+    w.end();
+
+    for(size_t bi = 0; bi < binds.size(); ++bi) {
+        ushort vertexSize = 0;
+        for(const auto& e: binds[bi])
+            vertexSize += typeSize(e.type);
+        w.begin(0x5200); // M_GEOMETRY_VERTEX_BUFFER
+        w.s.write16((ushort)bi);
+        w.s.write16(vertexSize);
+        w.begin(0x5210); // M_GEOMETRY_VERTEX_BUFFER_DATA
+        for(const auto& v: vtx) {
+            for(const auto& e: binds[bi])
+                writeField(w.s, v, e);
+        }
+        w.end();
+        w.end();
+    }
+    w.end();
+}
+
+static void writeIndices(ChunkWriter& w, const vector<uint>& indices, uint numVtx)
+{
+    bool idx32 = numVtx > 0xffff;
+    w.s.writeBool(false); // shared vertices
+    w.s.write32((uint)indices.size());
+    w.s.writeBool(idx32);
+    for(uint i: indices) {
+        if (idx32)
+            w.s.write32(i);
+        else
+            w.s.write16((ushort)i);
+    }
+}
+
+static void writeBounds(ChunkWriter& w, const float* minp, const float* maxp, float radius)
+{
+    w.begin(0x9000); // M_MESH_BOUNDS
+    for(int i = 0; i < 3; ++i)
+        w.s.write32f(minp[i]);
+    for(int i = 0; i < 3; ++i)
+        w.s.write32f(maxp[i]);
+    w.s.write32f(radius);
+    w.end();
+}
+
+static void writeBounds(ChunkWriter& w, float size)
+{
+    float minp[3] = { -size, -size, -size };
+    float maxp[3] = { size, size, size };
+    writeBounds(w, minp, maxp, size * 1.75f);
+}
+
+// random vertices where some are copies of earlier ones
+static vector<BuildVertex> randomVertices(Rand& rnd, int numVtx, int dupPercent, int nearPercent)
+{
+    vector<BuildVertex> vtx(numVtx);
+    for(int i = 0; i < numVtx; ++i) {
+        auto& v = vtx[i];
+        int r = rnd.range(100);
+        if (i > 0 && r < dupPercent + nearPercent) {
+            v = vtx[rnd.range(i)];
+            if (r >= dupPercent) // almost the same tangent, unified only by unify_by_tan_epsilon
+                v.tangent[0] += 0.01f;
+            continue;
+        }
+        for(int j = 0; j < 3; ++j) {
+            v.pos[j] = rnd.uniform(-10.0f, 10.0f);
+            v.normal[j] = rnd.uniform(-1.0f, 1.0f);
+            v.tangent[j] = rnd.uniform(-1.0f, 1.0f);
+            v.binormal[j] = rnd.uniform(-1.0f, 1.0f);
+        }
+        for(int t = 0; t < 2; ++t) {
+            v.uv[t][0] = rnd.uniform(0.0f, 1.0f);
+            v.uv[t][1] = rnd.uniform(0.0f, 1.0f);
+        }
+        v.color = rnd.next() | 0xff000000;
+    }
+    return vtx;
+}
+
+static vector<uint> randomIndices(Rand& rnd, int numVtx, int numTri)
+{
+    vector<uint> indices(numTri * 3);
+    for(auto& i: indices)
+        i = (uint)rnd.range(numVtx);
+    return indices;
+}
+
+
+string MeshBuilder::gridTile(int n, int holesPercent, float cell)
+{
+    Rand rnd(1);
+    vector<BuildVertex> vtx;
+    vector<uint> indices;
+    static const int corners[4][2] = { {0,0}, {0,1}, {1,0}, {1,1} };
+    for(int qx = 0; qx < n; ++qx) {
+        for(int qz = 0; qz < n; ++qz) {
+            if (rnd.range(100) < holesPercent)
+                continue;
+            uint first = (uint)vtx.size();
+            for(const auto& c: corners) {
+                BuildVertex v = {};
+                v.pos[0] = (qx + c[0]) * cell;
+                v.pos[2] = (qz + c[1]) * cell;
+                v.normal[1] = 1.0f;
+                v.tangent[0] = 1.0f;
+                v.binormal[2] = 1.0f;
+                v.uv[0][0] = (float)c[0];
+                v.uv[0][1] = (float)c[1];
+                v.color = 0xffffffff;
+                vtx.push_back(v);
+            }
+            uint quad[6] = { first, first + 1, first + 2, first + 2, first + 1, first + 3 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    vector<BuildBind> binds = { { {VET_FLOAT3, VES_POSITION, 0}, {VET_FLOAT3, VES_NORMAL, 0}, {VET_COLOUR_ABGR, VES_DIFFUSE, 0},
+                                  {VET_FLOAT2, VES_TEXTURE_COORDINATES, 0}, {VET_FLOAT3, VES_TANGENT, 0}, {VET_FLOAT3, VES_BINORMAL, 0} } };
+
+    string out;
+    ChunkWriter w(out);
+    writeHeader(w);
+    w.begin(0x3000); // M_MESH
+    w.s.writeBool(false); // skeletally animated
+    w.begin(0x4000); // M_SUBMESH
+    w.s.writeStr("terrain");
+    writeIndices(w, indices, (uint)vtx.size());
+    w.begin(0x4010); // M_SUBMESH_OPERATION
+    w.s.write16(4); // triangle list
+    w.end();
+    writeGeometry(w, vtx, binds);
+    w.end();
+    writeBounds(w, n * cell);
+    w.end();
+    return out;
+}
+
+string MeshBuilder::skinned(int numVtx, int numTri, int numBones, int dupPercent, int nearPercent)
+{
+    Rand rnd(2);
+    vector<BuildVertex> vtx = randomVertices(rnd, numVtx, dupPercent, nearPercent);
+    vector<uint> indices = randomIndices(rnd, numVtx, numTri);
+    vector<BuildBind> binds = { { {VET_FLOAT3, VES_POSITION, 0}, {VET_FLOAT3, VES_NORMAL, 0},
+                                  {VET_FLOAT2, VES_TEXTURE_COORDINATES, 0}, {VET_FLOAT3, VES_TANGENT, 0}, {VET_FLOAT3, VES_BINORMAL, 0} } };
+
+    string out;
+    ChunkWriter w(out);
+    writeHeader(w);
+    w.begin(0x3000); // M_MESH
+    w.s.writeBool(true); // skeletally animated
+    w.begin(0x4000); // M_SUBMESH
+    w.s.writeStr("skin");
+    writeIndices(w, indices, (uint)vtx.size());
+    w.begin(0x4010); // M_SUBMESH_OPERATION
+    w.s.write16(4);
+    w.end();
+    writeGeometry(w, vtx, binds);
+    // two bones per vertex
+    for(int i = 0; i < numVtx; ++i) {
+        for(int b = 0; b < 2; ++b) {
+            w.begin(0x4100); // M_SUBMESH_BONE_ASSIGNMENT
+            w.s.write32((uint)i);
+            w.s.write16((ushort)((i + b) % numBones));
+            w.s.write32f(0.5f);
+            w.end();
+        }
+    }
+    w.end();
+    w.begin(0x6000); // M_MESH_SKELETON_LINK
+    w.s.writeStr("skin.skeleton");
+    w.end();
+    writeBounds(w, 10.0f);
+    w.end();
+    return out;
+}
+
+string MeshBuilder::multiBuffer(int numSub, int vtxPerSub, int triPerSub, int dupPercent)
+{
+    Rand rnd(3);
+    vector<BuildBind> binds = { { {VET_FLOAT3, VES_POSITION, 0}, {VET_FLOAT3, VES_NORMAL, 0} },
+                                { {VET_COLOUR_ABGR, VES_DIFFUSE, 0}, {VET_FLOAT2, VES_TEXTURE_COORDINATES, 0},
+                                  {VET_FLOAT2, VES_TEXTURE_COORDINATES, 1}, {VET_FLOAT3, VES_TANGENT, 0}, {VET_FLOAT3, VES_BINORMAL, 0} } };
+    string out;
+    ChunkWriter w(out);
+    writeHeader(w);
+    w.begin(0x3000); // M_MESH
+    w.s.writeBool(false);
+    for(int sub = 0; sub < numSub; ++sub) {
+        vector<BuildVertex> vtx = randomVertices(rnd, vtxPerSub, dupPercent, 0);
+        vector<uint> indices = randomIndices(rnd, vtxPerSub, triPerSub);
+        w.begin(0x4000); // M_SUBMESH
+        w.s.writeStr(sub % 2 ? "matA" : "matB");
+        writeIndices(w, indices, (uint)vtx.size());
+        w.begin(0x4010); // M_SUBMESH_OPERATION
+        w.s.write16(4);
+        w.end();
+        writeGeometry(w, vtx, binds);
+        w.end();
+    }
+    writeBounds(w, 10.0f);
+    w.end();
+    return out;
+}
+
+// the fields of a vertex that come from an OBJ corner, compared by their bits
+struct WeldKey {
+    float f[8];
+    bool operator==(const WeldKey& o) const {
+        return memcmp(f, o.f, sizeof(f)) == 0;
+    }
+};
+struct WeldKeyHash {
+    size_t operator()(const WeldKey& k) const {
+        uint h = 2166136261u; // FNV-1a over the words
+        const uint* w = (const uint*)k.f;
+        for(int i = 0; i < 8; ++i)
+            h = (h ^ w[i]) * 16777619u;
+        return h;
+    }
+};
+
+// the vertices and triangles of one material
+struct ObjSubMesh {
+    string material;
+    vector<BuildVertex> vtx;
+    vector<uint> indices;
+    unordered_map<WeldKey, uint, WeldKeyHash> welded;
+};
+
+string MeshBuilder::fromObj(const ObjData& obj)
+{
+    CHECK(!obj.corners.empty(), "No faces in obj");
+    bool hasNormal = false, hasTex = false;
+    for(const auto& c: obj.corners) {
+        hasNormal |= (c.vn >= 0);
+        hasTex |= (c.vt >= 0);
+    }
+
+    vector<ObjSubMesh> subs;
+    map<string, size_t> subByMaterial;
+    float minp[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, maxp[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float radius2 = 0.0f;
+    string material = "BaseWhite"; // the default of Ogre, for faces before any usemtl
+    size_t nextRange = 0;
+    ObjSubMesh* sub = nullptr;
+    for(size_t ci = 0; ci < obj.corners.size(); ++ci) {
+        bool changed = (sub == nullptr);
+        for(; nextRange < obj.materials.size() && obj.materials[nextRange].start == ci; ++nextRange) {
+            material = obj.materials[nextRange].material;
+            changed = true;
+        }
+        if (changed) {
+            auto it = subByMaterial.find(material);
+            if (it == subByMaterial.end()) {
+                it = subByMaterial.insert(make_pair(material, subs.size())).first;
+                subs.push_back(ObjSubMesh());
+                subs.back().material = material;
+            }
+            sub = &subs[it->second];
+        }
+
+        const ObjCorner& c = obj.corners[ci];
+        BuildVertex v = {};
+        const Vec3& pos = obj.pos[c.v];
+        v.pos[0] = pos.x; v.pos[1] = pos.y; v.pos[2] = pos.z;
+        if (c.vn >= 0) {
+            const Vec3& n = obj.normal[c.vn];
+            v.normal[0] = n.x; v.normal[1] = n.y; v.normal[2] = n.z;
+        }
+        if (c.vt >= 0) {
+            v.uv[0][0] = obj.tex[c.vt].x;
+            v.uv[0][1] = obj.tex[c.vt].y;
+        }
+        // adding 0 turns -0 to 0 so they are welded
+        WeldKey key = { { v.pos[0] + 0.0f, v.pos[1] + 0.0f, v.pos[2] + 0.0f, v.normal[0] + 0.0f, v.normal[1] + 0.0f,
+                          v.normal[2] + 0.0f, v.uv[0][0] + 0.0f, v.uv[0][1] + 0.0f } };
+        auto ins = sub->welded.insert(make_pair(key, (uint)sub->vtx.size()));
+        if (ins.second) {
+            sub->vtx.push_back(v);
+            float len2 = 0.0f;
+            for(int i = 0; i < 3; ++i) {
+                minp[i] = min(minp[i], v.pos[i]);
+                maxp[i] = max(maxp[i], v.pos[i]);
+                len2 += v.pos[i] * v.pos[i];
+            }
+            radius2 = max(radius2, len2);
+        }
+        sub->indices.push_back(ins.first->second);
+    }
+
+    vector<BuildBind> binds(1);
+    binds[0].push_back({VET_FLOAT3, VES_POSITION, 0});
+    if (hasNormal)
+        binds[0].push_back({VET_FLOAT3, VES_NORMAL, 0});
+    if (hasTex)
+        binds[0].push_back({VET_FLOAT2, VES_TEXTURE_COORDINATES, 0});
+
+    string out;
+    ChunkWriter w(out);
+    writeHeader(w);
+    w.begin(0x3000); // M_MESH
+    w.s.writeBool(false); // skeletally animated
+    for(auto& s: subs) {
+        s.welded.clear();
+        w.begin(0x4000); // M_SUBMESH
+        w.s.writeStr(s.material);
+        writeIndices(w, s.indices, (uint)s.vtx.size());
+        w.begin(0x4010); // M_SUBMESH_OPERATION
+        w.s.write16(4); // triangle list
+        w.end();
+        writeGeometry(w, s.vtx, binds);
+        w.end();
+    }
+    writeBounds(w, minp, maxp, sqrt(radius2));
+    w.end();
+    return out;
+}
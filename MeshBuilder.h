@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include "ogre_types.h"
+
+using namespace std;
+
+struct ObjData;
+
+// generates .mesh files in memory, synthetic ones for benchmarks and ones imported from OBJ.
+// the generators are deterministic so that results can be compared between runs
+class MeshBuilder
+{
+public:
+    // flat terrain tile of n*n quads with 4 vertices each, like the tiles terrainProcess works on.
+    // holesPercent of the quads are left out so that quad solving has some work to do
+    static string gridTile(int n, int holesPercent = 10, float cell = 20.0f);
+
+    // single submesh with one vertex buffer and bone assignments. dupPercent of the vertices are
+    // exact duplicates of an earlier one and nearPercent differ from one only by a small tangent change
+    static string skinned(int numVtx, int numTri, int numBones, int dupPercent = 20, int nearPercent = 10);
+
+    // several submeshes with the vertex fields split over two vertex buffers
+    static string multiBuffer(int numSub, int vtxPerSub, int triPerSub, int dupPercent = 20);
+
+    // a submesh for every material, each with one interleaved vertex buffer of position and the normal and
+    // texture coordinate if the OBJ has them. corners with the same values are welded to one vertex and
+    // the indices are 16 bit when the submesh has few enough vertices
+    static string fromObj(const ObjData& obj);
+};
@@ -1,6 +1,10 @@
 #include <cmath>
 #include <cfloat>
+#include <cstring>
+#include <cstdint>
 #include <fstream>
+#include <algorithm>
+#include <unordered_set>
 #include "Mesh.h"
 
 
@@ -47,9 +51,98 @@ string makeKey(const VtxInfo & v, uint which) {
     if (checkFlag(which, VF_TEXCOORD3)) k += makeStr(v.tex[3]);
     if (checkFlag(which, VF_TANGENT))   k += makeStr(v.tangent);
     if (checkFlag(which, VF_BINORMAL))  k += makeStr(v.binormal);
+    k += v.animKey; // vertices that animate differently are never the same
     return k;
 }
 
+// gather the morph keyframe and pose data of every vertex into its animKey, so that vertices
+// are considered duplicates only if they also match in every keyframe and every pose
+void Mesh::buildAnimKeys()
+{
+    if (m_morphKeys.empty() && m_poses.empty())
+        return;
+    for(int target = 0; target <= (int)m_sub.size(); ++target) {
+        if (target == 0 && m_sharedGeom.get() == nullptr)
+            continue;
+        for(auto& vtx: animTargetGeom(target)->m_vtx)
+            vtx.animKey.clear();
+    }
+
+    for(const auto& key: m_morphKeys) {
+        auto& vtxs = animTargetGeom(key.target)->m_vtx;
+        int fpv = key.floatsPerVtx();
+        CHECK(key.data.size() == vtxs.size() * fpv, "Morph keyframe does not match vertex count");
+        for(size_t i = 0; i < vtxs.size(); ++i)
+            vtxs[i].animKey.append((const char*)&key.data[i * fpv], fpv * sizeof(float));
+    }
+    for(const auto& pose: m_poses) {
+        auto& vtxs = animTargetGeom(pose.target)->m_vtx;
+        vector<const PoseVertex*> byVtx(vtxs.size(), nullptr);
+        for(const auto& pv: pose.vtx)
+            byVtx[pv.vertexIndex] = &pv;
+        for(size_t i = 0; i < vtxs.size(); ++i) {
+            auto& k = vtxs[i].animKey;
+            if (byVtx[i] == nullptr) {
+                k += '\0'; // not moved by this pose
+                continue;
+            }
+            k += '\1';
+            k += makeStr(byVtx[i]->offset);
+            if (pose.hasNormals)
+                k += makeStr(byVtx[i]->normal);
+        }
+    }
+}
+
+// after dedup of a geometry, compact the morph keyframes and pose vertices that refer to it
+void Mesh::remapVtxAnim(int target, const vector<int>& oldToNew)
+{
+    if (m_morphKeys.empty() && m_poses.empty())
+        return;
+    // all the old vertices that map to a new vertex have the same animation data, take the first
+    int newCount = animTargetGeom(target)->m_vertexCount;
+    vector<int> newToOld(newCount, -1);
+    for(size_t i = 0; i < oldToNew.size(); ++i) {
+        if (oldToNew[i] != -1 && newToOld[oldToNew[i]] == -1)
+            newToOld[oldToNew[i]] = (int)i;
+    }
+
+    for(auto& key: m_morphKeys) {
+        if (key.target != target)
+            continue;
+        int fpv = key.floatsPerVtx();
+        vector<float> newData((size_t)newCount * fpv);
+        for(int i = 0; i < newCount; ++i) {
+            CHECK(newToOld[i] != -1, "new vertex without old vertex (morph)");
+            memcpy(&newData[i * fpv], &key.data[newToOld[i] * fpv], fpv * sizeof(float));
+        }
+        key.chunk->grow(((int)newData.size() - (int)key.data.size()) * (int)sizeof(float));
+        if (newData != key.data)
+            key.chunk->touch();
+        key.data = std::move(newData);
+    }
+
+    for(auto& pose: m_poses) {
+        if (pose.target != target)
+            continue;
+        vector<PoseVertex> newVtx;
+        vector<bool> seen(newCount, false);
+        for(auto& pv: pose.vtx) {
+            int ni = oldToNew[pv.vertexIndex];
+            if (ni == -1 || seen[ni]) { // removed, or a duplicate of a vertex already in this pose
+                pv.chunk->detach();
+                continue;
+            }
+            seen[ni] = true;
+            if (pv.vertexIndex != (uint)ni)
+                pv.chunk->touch();
+            pv.vertexIndex = (uint)ni;
+            newVtx.push_back(pv);
+        }
+        pose.vtx = std::move(newVtx);
+    }
+}
+
 float myfabs(float v) {
     return (v < 0) ? (-v) : v;
 }
@@ -103,7 +196,7 @@ int SubMesh::dupsByVecEpsilon(float epsilon, int vtxFlags)
     map<string, vector<VtxInfo *>> acc;     // pointers to m_vtx
 
     for(auto& vtx: m_vtx) {
-        acc[makeKey(vtx, ALL_BUT(vtxFlags))].push_back(&vtx);
+        acc[makeKey(vtx, m_hasEntries & ALL_BUT(vtxFlags))].push_back(&vtx);
     }
 
     // there might still be differences in the tangent, mark only those who are actually dups
@@ -148,8 +241,8 @@ int SubMesh::dupsByVecEpsilon(float epsilon, int vtxFlags)
     return epsilonDups;
 }
 
-// marks duplicates
-int Mesh::dupsByTanEpsilon(float epsilon)
+// epsilon 0.0 means the default
+float Mesh::tanEpsilon(float epsilon)
 {
     if (epsilon == 0.0) {
         if (m_defaultEpsilon != 0.0)
@@ -157,6 +250,14 @@ int Mesh::dupsByTanEpsilon(float epsilon)
         else
             epsilon = 0.2f;
     }
+    return epsilon;
+}
+
+// marks duplicates
+int Mesh::dupsByTanEpsilon(float epsilon)
+{
+    epsilon = tanEpsilon(epsilon);
+    buildAnimKeys();
     int count = 0;
     for(auto& sub: m_sub) {
         sub.clearIsDupOf();
@@ -177,9 +278,9 @@ int SubMesh::dupsExact(int sem, int index)
     uint keyFlag = m_hasEntries; // default is by all entries
     if (sem != -1) {
         uint gotFlag = vtxFlagFromSem(sem, index);
-        if (!checkFlag(m_hasEntries, keyFlag)) //, "Mesh does not have entry " << semanticName(sem) << " " << sem << " index " << index);
+        if (!checkFlag(m_hasEntries, gotFlag)) //, "Mesh does not have entry " << semanticName(sem) << " " << sem << " index " << index);
             return 0;
-        keyFlag = ALL_BUT(gotFlag);
+        keyFlag = m_hasEntries & ALL_BUT(gotFlag);
     }
     // maps key to the first occurance of this information
     map<string, VtxInfo *> acc;     // pointers to m_vtx
@@ -199,6 +300,82 @@ int SubMesh::dupsExact(int sem, int index)
 #endif
 }
 
+#ifdef MESH_TOOL // only the estimate of dupsExact uses these
+// the fields that make up the key of a vertex
+static const uint KEY_FIELDS[] = { VF_POSITION, VF_NORMAL, VF_DIFFUSE, VF_TEXCOORD0, VF_TEXCOORD1, VF_TEXCOORD2, VF_TEXCOORD3, VF_TANGENT, VF_BINORMAL };
+static const int KEY_FIELDS_COUNT = sizeof(KEY_FIELDS) / sizeof(KEY_FIELDS[0]);
+
+// FNV-1a followed by a finalizer so that the sum of a few of these is still well mixed
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    const unsigned char* p = (const unsigned char*)data;
+    for(size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hashField(const VtxInfo& v, int field)
+{
+    switch(KEY_FIELDS[field]) {
+    case VF_POSITION:  return hashBytes(&v.pos, sizeof(v.pos), field);
+    case VF_NORMAL:    return hashBytes(&v.normal, sizeof(v.normal), field);
+    case VF_DIFFUSE:   return hashBytes(&v.diffuse, sizeof(v.diffuse), field);
+    case VF_TEXCOORD0: return hashBytes(&v.tex[0], sizeof(v.tex[0]), field);
+    case VF_TEXCOORD1: return hashBytes(&v.tex[1], sizeof(v.tex[1]), field);
+    case VF_TEXCOORD2: return hashBytes(&v.tex[2], sizeof(v.tex[2]), field);
+    case VF_TEXCOORD3: return hashBytes(&v.tex[3], sizeof(v.tex[3]), field);
+    case VF_TANGENT:   return hashBytes(&v.tangent, sizeof(v.tangent), field);
+    case VF_BINORMAL:  return hashBytes(&v.binormal, sizeof(v.binormal), field);
+    }
+    return 0;
+}
+#endif
+
+// same as calling dupsExact() with nothing removed and with every field removed, in a single pass.
+// every field of a vertex is hashed once, the key hash without a field is the sum of the hashes of the rest of the fields.
+// counts by hash and not by the full key so it is only an estimate, but a 64 bit hash practically never collides
+void SubMesh::estimateDups(map<uint, int>* dupsWithout)
+{
+#ifndef MESH_TOOL
+    (void)dupsWithout; // dupsExact is disabled too so there are no duplicates to estimate
+#else
+    vector<int> fields;
+    for(int f = 0; f < KEY_FIELDS_COUNT; ++f)
+        if (checkFlag(m_hasEntries, KEY_FIELDS[f]))
+            fields.push_back(f);
+    // index 0 is the full key, index i+1 is the key without fields[i]
+    vector<unordered_set<uint64_t>> seen(fields.size() + 1);
+    vector<int> counts(fields.size() + 1, 0);
+    for(auto& s: seen)
+        s.reserve(m_vtx.size());
+
+    vector<uint64_t> fieldHash(fields.size());
+    for(const auto& vtx: m_vtx) {
+        uint64_t full = hashBytes(vtx.animKey.data(), vtx.animKey.size(), KEY_FIELDS_COUNT);
+        for(size_t i = 0; i < fields.size(); ++i) {
+            fieldHash[i] = hashField(vtx, fields[i]);
+            full += fieldHash[i];
+        }
+        if (!seen[0].insert(full).second)
+            ++counts[0];
+        for(size_t i = 0; i < fields.size(); ++i) {
+            if (!seen[i + 1].insert(full - fieldHash[i]).second)
+                ++counts[i + 1];
+        }
+    }
+
+    (*dupsWithout)[0] += counts[0];
+    for(size_t i = 0; i < fields.size(); ++i)
+        (*dupsWithout)[KEY_FIELDS[fields[i]]] += counts[i + 1];
+#endif
+}
+
 void SubMesh::clearIsDupOf()
 {
     for(auto& vtx: m_vtx) {
@@ -219,6 +396,7 @@ void SubMesh::clearUsed()
 // find duplicates of verteces that contain exactly the same information
 // useful after removing fields
 int Mesh::dupsExact(int sem, int index) {
+    buildAnimKeys();
     int count = 0;
     for(auto& sub: m_sub) {
         sub.clearIsDupOf();
@@ -228,12 +406,18 @@ int Mesh::dupsExact(int sem, int index) {
 }
 
 
+map<uint, int> Mesh::estimateDups()
+{
+    buildAnimKeys();
+    map<uint, int> dupsWithout;
+    for(auto& sub: m_sub)
+        sub.estimateDups(&dupsWithout);
+    return dupsWithout;
+}
+
 // given an isDupOf field on vertices, deduplicate the mesh
 void SubMesh::dedup(vector<int>* outOldToNew)
 {
-    CHECK(!m_hasEdges, "Deduplication no supported for mesh with edge data");
-    // this would require going over the entire animation to verify the the duplication
-    CHECK(!m_hasVtxAnimation, "Deduplication not supported for mesh with vertex animation");
     if (m_isSharedGeom)
         return;
 
@@ -261,6 +445,7 @@ void SubMesh::dedup(vector<int>* outOldToNew)
 
     m_vertexCount = (int)newvtx.size();
     m_vtx = std::move(newvtx);
+    updateVertexDataSizes();
 
     fixIndices(oldToNew);
 
@@ -268,6 +453,37 @@ void SubMesh::dedup(vector<int>* outOldToNew)
         *outOldToNew = std::move(oldToNew);
 }
 
+// replace the index list, the submesh chunk grows or shrinks with it
+void SubMesh::setIndices(vector<uint>&& indices)
+{
+    if (m_chunk) {
+        m_chunk->grow(((int)indices.size() - (int)m_indicesCount) * (m_indices32bit ? 4 : 2));
+        m_chunk->touch();
+    }
+    m_indices = std::move(indices);
+    m_indicesCount = (uint)m_indices.size();
+}
+
+// after the number of vertices or the size of a vertex changed
+void SubMesh::updateVertexDataSizes()
+{
+    for(const auto& bind: m_entries) {
+        Chunk* data = bind.bufferChunk->child(0x5210); // M_GEOMETRY_VERTEX_BUFFER_DATA
+        CHECK(data != nullptr, "Vertex buffer without data chunk");
+        data->setSize(CHUNK_HEADER_SIZE + m_vertexCount * bind.entriesSize);
+    }
+}
+
+// the vertex declaration or the layout of the buffers changed, even if the sizes did not
+void SubMesh::touchDeclaration()
+{
+    for(const auto& bind: m_entries) {
+        bind.bufferChunk->touchTree();
+        for(const auto& entry: bind.e)
+            entry.entryChunk->touch();
+    }
+}
+
 // given a mapping of old indices to new, go over the m_indices list and fix it
 void SubMesh::fixIndices(const vector<int>& oldToNew)
 {
@@ -285,12 +501,25 @@ void SubMesh::fixIndices(const vector<int>& oldToNew)
     }
 
     // translate the bone assignments indices
+    bool bonesChanged = false;
     for(auto& b: m_boneAssign) {
         int ni = oldToNew[b.vertexIndex];
         CHECK(ni != -1, "new index not found (bone)");
+        bonesChanged |= (b.vertexIndex != (uint)ni);
         b.vertexIndex = ni;
     }
 
+    if (m_chunk) {
+        if (newindices != m_indices)
+            m_chunk->touch();
+        if (bonesChanged) {
+            for(const auto& c: m_chunk->sub) {
+                if (c->id == 0x4100) // M_SUBMESH_BONE_ASSIGNMENT
+                    c->touch();
+            }
+        }
+    }
+
     // commit
     m_indices = std::move(newindices);
 }
@@ -298,23 +527,210 @@ void SubMesh::fixIndices(const vector<int>& oldToNew)
 // removed the vertices that has a duplicate or marked as unused and fix the indices
 void Mesh::dedup()
 {
-    for(auto& sub: m_sub)
-        sub.dedup();
+    CHECK(!hasPassThroughVtxRefs(), "Deduplication not supported for mesh with unparsed chunks that reference vertices");
+    vector<vector<int>> subOldToNew(m_sub.size());
+    for(int i = 0; i < (int)m_sub.size(); ++i) {
+        m_sub[i].dedup(&subOldToNew[i]);
+        if (!subOldToNew[i].empty()) // empty for submeshes that use the shared geometry
+            remapVtxAnim(i + 1, subOldToNew[i]);
+    }
 
+    vector<int> sharedOldToNew;
     if (m_sharedGeom.get() != nullptr)
     {
-        vector<int> sharedOldToNew;
         m_sharedGeom->dedup(&sharedOldToNew);
+        remapVtxAnim(0, sharedOldToNew);
         for(auto& sub: m_sub) {
             if (sub.m_isSharedGeom) {
                 sub.fixIndices(sharedOldToNew);
             }
         }
     }
+
+    remapEdgeLists(subOldToNew, sharedOldToNew);
+}
+
+static int operationType(const SubMesh& sub)
+{
+    Chunk* c = sub.m_chunk->child(M_SUBMESH_OPERATION);
+    if (c == nullptr)
+        return OT_TRIANGLE_LIST;
+    CHECK(c->selfBuf.size() >= CHUNK_HEADER_SIZE + sizeof(ushort), "Short submesh operation chunk");
+    ushort op;
+    memcpy(&op, c->selfBuf.data() + CHUNK_HEADER_SIZE, sizeof(op));
+    return op;
+}
+
+// builds the edge list of LOD 0 from the current index buffers the way Ogre's EdgeListBuilder does.
+// vertices are welded by exact position, triangles are ordered by vertex set and an edge is connected
+// to the first triangle that has it in the reverse direction. returns false if the mesh has other kinds of geometry
+bool Mesh::buildEdgeList(EdgeListLod* el) const
+{
+    struct Geometry {
+        uint vertexSet, indexSet;
+        const SubMesh* sub;
+    };
+    vector<Geometry> geoms;
+    uint numSets = (m_sharedGeom.get() != nullptr) ? 1 : 0;
+    for(size_t i = 0; i < m_sub.size(); ++i) {
+        const auto& sub = m_sub[i];
+        if (operationType(sub) != OT_TRIANGLE_LIST)
+            return false;
+        geoms.push_back(Geometry{ sub.m_isSharedGeom ? 0 : numSets++, (uint)i, &sub });
+    }
+    stable_sort(geoms.begin(), geoms.end(), [](const Geometry& a, const Geometry& b) { return a.vertexSet < b.vertexSet; });
+    if (el->groups.size() != numSets)
+        return false;
+
+    el->tris.clear();
+    for(uint i = 0; i < numSets; ++i) {
+        auto& g = el->groups[i];
+        g.vertexSet = i;
+        g.triStart = 0;
+        g.triCount = 0;
+        g.edges.clear();
+    }
+
+    map<Vec3, uint> common; // welded position index of every position
+    map<pair<uint, uint>, pair<uint, size_t>> open; // edges that have only one triangle, to their group and index in it
+    for(size_t gi = 0; gi < geoms.size(); ++gi) {
+        const auto& geom = geoms[gi];
+        const auto& vtx = geom.sub->m_isSharedGeom ? m_sharedGeom->m_vtx : geom.sub->m_vtx;
+        auto& group = el->groups[geom.vertexSet];
+        if (gi == 0 || geoms[gi - 1].vertexSet != geom.vertexSet)
+            group.triStart = (uint)el->tris.size();
+
+        const auto& indices = geom.sub->m_indices;
+        for(size_t i = 0; i + 2 < indices.size(); i += 3) {
+            EdgeTriangle t;
+            t.indexSet = geom.indexSet;
+            t.vertexSet = geom.vertexSet;
+            Vec3 pos[3];
+            for(int j = 0; j < 3; ++j) {
+                t.vertIndex[j] = indices[i + j];
+                pos[j] = vtx[indices[i + j]].pos;
+                t.sharedVertIndex[j] = common.insert(make_pair(pos[j], (uint)common.size())).first->second;
+            }
+            if (t.sharedVertIndex[0] == t.sharedVertIndex[1] || t.sharedVertIndex[1] == t.sharedVertIndex[2] || t.sharedVertIndex[2] == t.sharedVertIndex[0])
+                continue; // degenerate triangle
+            Vec3 n = Vec3::crossProd(pos[1] - pos[0], pos[2] - pos[0]);
+            t.normal[0] = n.x;
+            t.normal[1] = n.y;
+            t.normal[2] = n.z;
+            t.normal[3] = -Vec3::dotProd(n, pos[0]);
+
+            uint triIndex = (uint)el->tris.size();
+            el->tris.push_back(t);
+            for(int j = 0; j < 3; ++j) {
+                int k = (j + 1) % 3;
+                auto it = open.find(make_pair(t.sharedVertIndex[k], t.sharedVertIndex[j]));
+                if (it != open.end()) {
+                    auto& e = el->groups[it->second.first].edges[it->second.second];
+                    e.triIndex[1] = triIndex;
+                    e.degenerate = false;
+                    open.erase(it);
+                    continue;
+                }
+                auto& edges = group.edges;
+                open.insert(make_pair(make_pair(t.sharedVertIndex[j], t.sharedVertIndex[k]), make_pair(geom.vertexSet, edges.size())));
+                EdgeData e;
+                e.triIndex[0] = triIndex;
+                e.triIndex[1] = UINT_MAX;
+                e.vertIndex[0] = t.vertIndex[j];
+                e.vertIndex[1] = t.vertIndex[k];
+                e.sharedVertIndex[0] = t.sharedVertIndex[j];
+                e.sharedVertIndex[1] = t.sharedVertIndex[k];
+                e.degenerate = true;
+                edges.push_back(e);
+            }
+        }
+        group.triCount = (uint)el->tris.size() - group.triStart;
+    }
+    el->isClosed = open.empty();
+    return true;
+}
+
+// translate the vertex indices of the edge lists after dedup
+// vertex sets are numbered the way Ogre's Mesh::buildEdgeList adds them: the shared geometry first,
+// then every submesh that has its own geometry. the position welded shared indices are not affected.
+// if triangles were removed or replaced the remapped list is stale and the edge list is built again
+void Mesh::remapEdgeLists(const vector<vector<int>>& subOldToNew, const vector<int>& sharedOldToNew)
+{
+    if (m_edgeLists.empty())
+        return;
+    vector<const vector<int>*> setOldToNew;
+    if (m_sharedGeom.get() != nullptr)
+        setOldToNew.push_back(&sharedOldToNew);
+    for(size_t i = 0; i < m_sub.size(); ++i) {
+        if (!m_sub[i].m_isSharedGeom)
+            setOldToNew.push_back(&subOldToNew[i]);
+    }
+
+    bool changed = false, removed = false;
+    auto remap = [&](uint vertexSet, uint* vi) {
+        CHECK(vertexSet < setOldToNew.size(), "Unexpected edge list vertex set " << vertexSet);
+        const auto& oldToNew = *setOldToNew[vertexSet];
+        CHECK(*vi < oldToNew.size(), "Edge list vertex index out of range");
+        int ni = oldToNew[*vi];
+        if (ni == -1) {
+            removed = true;
+            return;
+        }
+        changed |= (*vi != (uint)ni);
+        *vi = (uint)ni;
+    };
+    for(auto& el: m_edgeLists) {
+        if (el.isManual)
+            continue;
+        changed = false;
+        removed = false;
+        EdgeListLod remapped = el;
+        for(auto& t: remapped.tris) {
+            for(int j = 0; j < 3; ++j)
+                remap(t.vertexSet, &t.vertIndex[j]);
+        }
+        for(auto& g: remapped.groups) {
+            for(auto& e: g.edges) {
+                remap(g.vertexSet, &e.vertIndex[0]);
+                remap(g.vertexSet, &e.vertIndex[1]);
+            }
+        }
+
+        // generated LOD levels are not rebuilt, there is no dedup with LOD index buffers
+        EdgeListLod built = el;
+        if (el.lodIndex != 0 || !buildEdgeList(&built)) {
+            CHECK(!removed, "Edge list refers to a removed vertex");
+        }
+        else {
+            bool same = !removed && built.tris.size() == remapped.tris.size();
+            for(size_t i = 0; same && i < built.tris.size(); ++i) {
+                const auto& a = built.tris[i];
+                const auto& b = remapped.tris[i];
+                same = a.indexSet == b.indexSet && a.vertexSet == b.vertexSet && memcmp(a.vertIndex, b.vertIndex, sizeof(a.vertIndex)) == 0;
+            }
+            if (!same) { // the triangles changed since the file was written
+                el.chunk->grow(((int)built.tris.size() - (int)el.tris.size()) * (int)sizeof(EdgeTriangle));
+                size_t gi = 0;
+                for(const auto& c: el.chunk->sub) {
+                    if (c->id != 0xb110) // M_EDGE_GROUP
+                        continue;
+                    CHECK(gi < built.groups.size(), "Unexpected edge group chunk");
+                    c->grow(((int)built.groups[gi].edges.size() - (int)el.groups[gi].edges.size()) * 25);
+                    ++gi;
+                }
+                remapped = std::move(built);
+                changed = true;
+            }
+        }
+        if (changed) {
+            el = std::move(remapped);
+            el.chunk->touchTree();
+        }
+    }
 }
 
 
-void SubMesh::cullFaces(const vector<Vec3>& possibleEyes, SubMesh* sharedGeom)
+void SubMesh::cullFaces(const vector<Vec3>& possibleEyes, SubMesh* sharedGeom, ostream& out)
 {
     vector<Vec3> npossibleEyes;
     for(auto n: possibleEyes) {
@@ -367,11 +783,10 @@ void SubMesh::cullFaces(const vector<Vec3>& possibleEyes, SubMesh* sharedGeom)
             ++culledTri;
         }
     }
-    m_indices = std::move(newindices);
-    m_indicesCount = (int)m_indices.size();
+    setIndices(std::move(newindices));
 
 
-    cout << "Culled " << culledTri << "/" << totalTri << " = " << ((float)culledTri / totalTri * 100.0) << endl;
+    out << "Culled " << culledTri << "/" << totalTri << " = " << ((float)culledTri / totalTri * 100.0) << endl;
 }
 
 void Mesh::clearUsed()
@@ -383,10 +798,10 @@ void Mesh::clearUsed()
 }
 
 
-void Mesh::cullFaces(const vector<Vec3>& possibleEyes)
+void Mesh::cullFaces(const vector<Vec3>& possibleEyes, ostream& out)
 {
     for(auto& sub: m_sub) {
-        sub.cullFaces(possibleEyes, m_sharedGeom.get());
+        sub.cullFaces(possibleEyes, m_sharedGeom.get(), out);
     }
 }
 
@@ -440,6 +855,11 @@ void SubMesh::removeField(int sem, int index)
         CHECK(m_entries[foundInBind].e.size() == 0, "Unexpeceted size of entries vector"); // sanity
         m_entries[foundInBind].bufferChunk->detach(); //remove the buffer chunk
         m_entries.erase(m_entries.begin() + foundInBind); // remove the empty data about it
+        // the buffers after it move back one place, the entries need to point to the new buffer index
+        for(size_t bindIndex = foundInBind; bindIndex < m_entries.size(); ++bindIndex) {
+            for(auto& entry: m_entries[bindIndex].e)
+                entry.source = (int)bindIndex;
+        }
     }
 
     // now remove it from the buffer. each vertex holds its own portion of the big buffer
@@ -452,6 +872,8 @@ void SubMesh::removeField(int sem, int index)
             vi.selfBufs.erase(vi.selfBufs.begin() + foundInBind);
         }
     }
+    updateVertexDataSizes();
+    touchDeclaration();
 }
 
 void Mesh::removeField(int sem, int index)
@@ -468,9 +890,8 @@ bool SubMesh::buffersNeedUnify() {
 
 void SubMesh::unifyBuffers()
 {
-    if (m_entries.size() == 1)
-        return; // nothing to unify
-    CHECK(m_entries.size() >= 2, "emptry entries list?");
+    if (m_entries.size() <= 1)
+        return; // nothing to unify, no entries at all in a submesh that uses the shared geometry
     // create new entries vector with the unified fields
     vector<VtxBind> newEntries;
     newEntries.push_back(m_entries[0]);
@@ -503,6 +924,8 @@ void SubMesh::unifyBuffers()
         CHECK(buf.size() == unifiedBind.entriesSize, "Unexpected entriesSize");
         vi.selfBufs.resize(1);
     }
+    updateVertexDataSizes();
+    touchDeclaration();
 }
 
 
@@ -520,3 +943,342 @@ bool Mesh::buffersNeedUnify()
     return res;
 }
 
+// remove fields and optionally merge all buffers into one, in a single pass over the vertices
+void SubMesh::rewriteBuffers(const vector<pair<int, int>>& removeFields, bool unify)
+{
+    if (m_isSharedGeom)
+        return;
+    uint removeFlags = 0;
+    for(const auto& f: removeFields) {
+        auto vtxFlag = vtxFlagFromSem(f.first, f.second);
+        CHECK( checkFlag(m_hasEntries, vtxFlag), "Mesh does not have semantic " << semanticName(f.first) << " index=" << f.second);
+        removeFlags |= vtxFlag;
+    }
+
+    // a range of bytes in an old buffer that is copied to a new buffer
+    struct Span {
+        size_t bind;
+        int offset, size;
+    };
+    vector<VtxBind> newEntries;
+    vector<vector<Span>> newSpans; // for every new buffer, the ranges it is made of
+
+    for(size_t bindIndex = 0; bindIndex < m_entries.size(); ++bindIndex)
+    {
+        auto& bind = m_entries[bindIndex];
+        if (!unify || newEntries.empty()) {
+            newEntries.push_back(VtxBind());
+            newEntries.back().bufferChunk = bind.bufferChunk;
+            newSpans.push_back(vector<Span>());
+        }
+        else {
+            bind.bufferChunk->detach(); // merged into the first buffer
+        }
+        auto& newBind = newEntries.back();
+        auto& spans = newSpans.back();
+
+        for(const auto& entry: bind.e) {
+            if ((vtxFlagFromSem(entry.sem, entry.index) & removeFlags) != 0) {
+                entry.entryChunk->detach();
+                continue;
+            }
+            VtxEntry ecopy = entry;
+            ecopy.source = (int)newEntries.size() - 1;
+            ecopy.offset = newBind.entriesSize;
+            newBind.entriesSize += typeSize(ecopy.type);
+            newBind.e.push_back(ecopy);
+            int size = typeSize(entry.type);
+            if (!spans.empty() && spans.back().bind == bindIndex && spans.back().offset + spans.back().size == entry.offset)
+                spans.back().size += size; // continues the previous range
+            else
+                spans.push_back(Span{bindIndex, entry.offset, size});
+        }
+
+        // a buffer that remains empty is deleted completely
+        bool lastBind = unify ? (bindIndex == m_entries.size() - 1) : true;
+        if (lastBind && newBind.entriesSize == 0) {
+            newBind.bufferChunk->detach();
+            newEntries.pop_back();
+            newSpans.pop_back();
+        }
+    }
+
+    // now build the new buffers of every vertex
+    for(auto& vi: m_vtx)
+    {
+        vector<string> bufs(newEntries.size());
+        for(size_t i = 0; i < newEntries.size(); ++i) {
+            bufs[i].reserve(newEntries[i].entriesSize);
+            for(const auto& span: newSpans[i])
+                bufs[i].append(vi.selfBufs[span.bind], span.offset, span.size);
+        }
+        vi.selfBufs = std::move(bufs);
+    }
+
+    m_entries = std::move(newEntries);
+    m_hasEntries &= ALL_BUT(removeFlags);
+    updateVertexDataSizes();
+    touchDeclaration();
+}
+
+// the primitive type the indices are drawn with, a triangle list when there's no operation chunk
+// other can be drawn as part of this submesh: same material, same vertex declaration and both triangle lists
+bool SubMesh::canAppend(const SubMesh& other) const
+{
+    if (other.m_material != m_material || other.m_isSharedGeom != m_isSharedGeom)
+        return false;
+    if (operationType(*this) != OT_TRIANGLE_LIST || operationType(other) != OT_TRIANGLE_LIST)
+        return false;
+    // Ogre attaches vertices that have no bone assignments to the first bone
+    if (m_boneAssign.empty() != other.m_boneAssign.empty() || (m_isSharedGeom && !m_boneAssign.empty()))
+        return false;
+    // texture aliases are per submesh
+    for(const SubMesh* s: { this, &other }) {
+        for(const auto& c: s->m_chunk->sub) {
+            if (c->id != M_GEOMETRY && c->id != M_SUBMESH_OPERATION && c->id != M_SUBMESH_BONE_ASSIGNMENT)
+                return false;
+        }
+    }
+
+    if (m_entries.size() != other.m_entries.size())
+        return false;
+    for(size_t bindIndex = 0; bindIndex < m_entries.size(); ++bindIndex) {
+        const auto& a = m_entries[bindIndex];
+        const auto& b = other.m_entries[bindIndex];
+        if (a.entriesSize != b.entriesSize || a.e.size() != b.e.size())
+            return false;
+        for(size_t i = 0; i < a.e.size(); ++i) {
+            const auto& ea = a.e[i];
+            const auto& eb = b.e[i];
+            if (ea.source != eb.source || ea.offset != eb.offset || ea.type != eb.type || ea.sem != eb.sem || ea.index != eb.index)
+                return false;
+        }
+    }
+    return true;
+}
+
+// add the vertices and triangles of other after the ones of this submesh. the chunk of other is removed
+// from the tree and its bone assignment chunks move to this submesh
+void SubMesh::append(SubMesh& other)
+{
+    uint base = m_isSharedGeom ? 0 : (uint)m_vertexCount;
+    if (!m_isSharedGeom) {
+        // the indices of the vertices of other don't fit in 16 bit
+        if (!m_indices32bit && m_vertexCount + other.m_vertexCount > 0x10000) {
+            m_indices32bit = true;
+            m_chunk->grow(m_indicesCount * 2);
+            m_chunk->touch();
+        }
+        m_vtx.reserve(m_vtx.size() + other.m_vtx.size());
+        for(auto& vtx: other.m_vtx) {
+            m_vtx.push_back(std::move(vtx));
+            m_vtx.back().index = (int)m_vtx.size() - 1;
+        }
+        m_vertexCount += other.m_vertexCount;
+        clearIsDupOf(); // pointers into the vectors that were moved
+        updateVertexDataSizes();
+    }
+
+    vector<uint> indices = m_indices;
+    indices.reserve(indices.size() + other.m_indices.size());
+    for(uint i: other.m_indices)
+        indices.push_back(base + i);
+    setIndices(std::move(indices));
+
+    for(auto b: other.m_boneAssign) {
+        b.vertexIndex += base;
+        m_boneAssign.push_back(b);
+    }
+    other.m_chunk->detach();
+    for(const auto& c: other.m_chunk->sub) {
+        if (c->id != M_SUBMESH_BONE_ASSIGNMENT)
+            continue;
+        c->parent = m_chunk.get();
+        m_chunk->sub.push_back(c);
+        m_chunk->grow(c->size);
+        c->touch();
+    }
+}
+
+// animations, edge lists, LOD and extremes refer to submeshes by index and are not renumbered
+bool Mesh::canMergeSubmeshes()
+{
+    if (!m_poses.empty() || !m_morphKeys.empty() || !m_edgeLists.empty() || !m_passThroughIds.empty())
+        return false;
+    for(size_t i = 0; i < m_sub.size(); ++i) {
+        for(size_t j = i + 1; j < m_sub.size(); ++j) {
+            if (m_sub[i].canAppend(m_sub[j]))
+                return true;
+        }
+    }
+    return false;
+}
+
+// every submesh is appended to the first one before it that it can be drawn with, to save draw calls
+void Mesh::mergeSubmeshes()
+{
+    if (!canMergeSubmeshes())
+        return; // also when there's nothing to merge
+    Chunk* names = m_sub[0].m_chunk->parent->child(M_SUBMESH_NAME_TABLE);
+
+    vector<SubMesh> newsub;
+    vector<int> oldToNew(m_sub.size(), -1); // only for the submeshes that remain
+    for(size_t i = 0; i < m_sub.size(); ++i) {
+        auto& sub = m_sub[i];
+        bool appended = false;
+        for(auto& target: newsub) {
+            if (target.canAppend(sub)) {
+                target.append(sub);
+                appended = true;
+                break;
+            }
+        }
+        if (!appended) {
+            oldToNew[i] = (int)newsub.size();
+            newsub.push_back(std::move(sub));
+        }
+    }
+    m_sub = std::move(newsub);
+    m_cursub = nullptr;
+
+    // the names of submeshes that were appended to another are dropped
+    if (names != nullptr) {
+        vector<shared_ptr<Chunk>> elements = names->sub; // detach changes the list
+        for(const auto& e: elements) {
+            CHECK(e->selfBuf.size() >= CHUNK_HEADER_SIZE + sizeof(ushort), "Short submesh name chunk");
+            ushort index;
+            memcpy(&index, e->selfBuf.data() + CHUNK_HEADER_SIZE, sizeof(index));
+            CHECK(index < oldToNew.size(), "Name of submesh " << index << " that does not exist");
+            if (oldToNew[index] == -1) {
+                e->detach();
+                continue;
+            }
+            ushort newIndex = (ushort)oldToNew[index];
+            if (newIndex != index) {
+                memcpy(&e->selfBuf[CHUNK_HEADER_SIZE], &newIndex, sizeof(newIndex));
+                e->touch();
+            }
+        }
+    }
+}
+
+// nothing in the mesh refers to its submeshes by index and there's no skeleton, so another mesh can be
+// appended to it or it can be appended to another mesh
+bool Mesh::isAppendable()
+{
+    Chunk* meshChunk = m_rootChunk ? m_rootChunk->child(M_MESH) : nullptr;
+    if (meshChunk == nullptr || m_sharedGeom.get() != nullptr)
+        return false;
+    if (!m_poses.empty() || !m_morphKeys.empty() || !m_edgeLists.empty() || !m_passThroughIds.empty())
+        return false;
+    return meshChunk->child(M_SUBMESH_NAME_TABLE) == nullptr && meshChunk->child(M_MESH_SKELETON_LINK) == nullptr;
+}
+
+// adds the submeshes of other to this mesh. each one is appended to a submesh it can be drawn with or moves
+// over as a new submesh. the bounds grow to contain both meshes. other is left empty
+void Mesh::append(Mesh& other)
+{
+    CHECK(isAppendable() && other.isAppendable(), "Appending meshes with shared geometry, animations, edge lists, skeletons or submesh names not supported");
+    Chunk* meshChunk = m_rootChunk->child(M_MESH);
+
+    for(auto& sub: other.m_sub) {
+        SubMesh* target = nullptr;
+        for(auto& t: m_sub) {
+            if (t.canAppend(sub)) {
+                target = &t;
+                break;
+            }
+        }
+        if (target != nullptr) {
+            target->append(sub);
+            continue;
+        }
+        // the submesh chunk goes after the last submesh. it was not parsed from the source of this mesh
+        auto it = meshChunk->sub.begin();
+        for(auto c = meshChunk->sub.begin(); c != meshChunk->sub.end(); ++c) {
+            if ((*c)->id == M_SUBMESH)
+                it = c + 1;
+        }
+        sub.m_chunk->detach();
+        sub.m_chunk->parent = meshChunk;
+        meshChunk->sub.insert(it, sub.m_chunk);
+        meshChunk->grow(sub.m_chunk->size);
+        sub.m_chunk->touchTree();
+        m_materials.insert(sub.m_material);
+        m_sub.push_back(std::move(sub));
+    }
+    m_cursub = nullptr;
+
+    MeshBounds b, ob;
+    if (getBounds(&b) && other.getBounds(&ob)) {
+        b.min.x = min(b.min.x, ob.min.x);
+        b.min.y = min(b.min.y, ob.min.y);
+        b.min.z = min(b.min.z, ob.min.z);
+        b.max.x = max(b.max.x, ob.max.x);
+        b.max.y = max(b.max.y, ob.max.y);
+        b.max.z = max(b.max.z, ob.max.z);
+        b.radius = max(b.radius, ob.radius);
+        setBounds(b);
+    }
+    other.clear();
+}
+
+static Chunk* boundsChunk(const shared_ptr<Chunk>& root)
+{
+    Chunk* meshChunk = root ? root->child(M_MESH) : nullptr;
+    return (meshChunk != nullptr) ? meshChunk->child(M_MESH_BOUNDS) : nullptr;
+}
+
+// the bounds are kept only in the chunk data. false if the mesh has no bounds chunk
+bool Mesh::getBounds(MeshBounds* b)
+{
+    Chunk* c = boundsChunk(m_rootChunk);
+    if (c == nullptr)
+        return false;
+    float v[7];
+    CHECK(c->selfBuf.size() >= CHUNK_HEADER_SIZE + sizeof(v), "Short mesh bounds chunk");
+    memcpy(v, c->selfBuf.data() + CHUNK_HEADER_SIZE, sizeof(v));
+    b->min = Vec3{ v[0], v[1], v[2] };
+    b->max = Vec3{ v[3], v[4], v[5] };
+    b->radius = v[6];
+    return true;
+}
+
+void Mesh::setBounds(const MeshBounds& b)
+{
+    Chunk* c = boundsChunk(m_rootChunk);
+    CHECK(c != nullptr, "Mesh has no bounds chunk");
+    float v[7] = { b.min.x, b.min.y, b.min.z, b.max.x, b.max.y, b.max.z, b.radius };
+    CHECK(c->selfBuf.size() >= CHUNK_HEADER_SIZE + sizeof(v), "Short mesh bounds chunk");
+    memcpy(&c->selfBuf[CHUNK_HEADER_SIZE], v, sizeof(v));
+    c->touch();
+}
+
+// run a few optimizations at once: remove fields and merge buffers in one pass over the vertices,
+// mark duplicates once and compact once at the end
+void Mesh::optimize(const OptimizePlan& plan)
+{
+    if (plan.mergeSubmeshes)
+        mergeSubmeshes();
+    if (!plan.removeFields.empty() || plan.unifyBuffers) {
+        for(auto& sub: m_sub)
+            sub.rewriteBuffers(plan.removeFields, plan.unifyBuffers);
+        if (m_sharedGeom && !plan.removeFields.empty())
+            m_sharedGeom->rewriteBuffers(plan.removeFields, false);
+    }
+
+    if (plan.dedup == OptimizePlan::DEDUP_NONE)
+        return;
+    // every submesh gets the same marking as running the procs one after the other.
+    // exact duplicates have the same key and are within epsilon so unifying by epsilon covers them
+    float epsilon = tanEpsilon(0.0);
+    buildAnimKeys();
+    for(auto& sub: m_sub) {
+        sub.clearIsDupOf();
+        if ((plan.dedup & OptimizePlan::DEDUP_TAN_EPSILON) && checkFlag(sub.m_hasEntries, VF_TANGENT | VF_BINORMAL))
+            sub.dupsByVecEpsilon(epsilon, VF_TANGENT | VF_BINORMAL);
+        else if (plan.dedup & OptimizePlan::DEDUP_EXACT)
+            sub.dupsExact();
+    }
+    dedup();
+}
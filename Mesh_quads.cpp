@@ -12,7 +12,7 @@
 
 // NOT working well since there is the same triangle in both orientations... TBD
 // for some reason some triangles appear twice...
-void Mesh::removeDupTri()
+void Mesh::removeDupTri(ostream& out)
 {
     int removedTri = 0, totalTri = 0;
     for(auto& sub: m_sub)
@@ -47,10 +47,9 @@ void Mesh::removeDupTri()
             newindices.push_back(c);
         }
 
-        sub.m_indices = std::move(newindices);
-        sub.m_indicesCount = (int)sub.m_indices.size();
+        sub.setIndices(std::move(newindices));
     }
-    cout << "Duplicate triangles removed=" << removedTri << "/" << totalTri << endl;
+    out << "Duplicate triangles removed=" << removedTri << "/" << totalTri << endl;
 }
 
 
@@ -214,7 +213,7 @@ static void quadsToObj(vector<Quad2D>& quads)
 }
 
 
-static void gridDim(const vector<Quad2D>& quads, int* height, int* width, Vec2* outmin, Vec2* outDelta)
+static void gridDim(const vector<Quad2D>& quads, int* height, int* width, Vec2* outmin, Vec2* outDelta, ostream& out)
 {
     Vec2 min{FLT_MAX, FLT_MAX}, max{FLT_MIN, FLT_MIN};
     auto firstq = quads[0];
@@ -223,7 +222,7 @@ static void gridDim(const vector<Quad2D>& quads, int* height, int* width, Vec2*
     for(const auto& q: quads) {
         float dx = std::abs(q.x1 - q.x2), dz = std::abs(q.z1 - q.z2);
         if (dx != stdDx || dz != stdDz) {
-            cout << "Mesh::extractQuads different size quads! " << dx << "," << dz << endl;
+            out << "Mesh::extractQuads different size quads! " << dx << "," << dz << endl;
             return;
         }
         min.minimize(q.x1, q.z1);
@@ -260,14 +259,14 @@ static void quadsToGrid(const vector<Quad2D>& quads, const Vec2& min, const Vec2
 }
 
 // find all the triangle pair that make an axis aligned quad and add it to the grid
-bool Mesh::extractQuads(float quadsHeight, QuadGrid* grid)
+bool Mesh::extractQuads(float quadsHeight, QuadGrid* grid, ostream& out)
 {
     vector<Quad2D> quads;
     for(auto& sub: m_sub)
         sub.extractQuads(quadsHeight, m_sharedGeom.get(), &quads);
 
     if (quads.size() < 2) {
-        cout << "Mesh::extractQuads no quads! " << quadsHeight << endl;
+        out << "Mesh::extractQuads no quads! " << quadsHeight << endl;
         return false;
     }
     //cout << "found quads " << quads.size() << endl;
@@ -276,7 +275,7 @@ bool Mesh::extractQuads(float quadsHeight, QuadGrid* grid)
 
     int height = 0, width = 0;
     Vec2 min, delta;
-    gridDim(quads, &height, &width, &min, &delta);
+    gridDim(quads, &height, &width, &min, &delta, out);
 
     grid->init(width, height, quadsHeight);
     quadsToGrid(quads, min, delta, grid);
@@ -339,8 +338,7 @@ void Mesh::replaceQuads(const QuadGrid& grid)
     }
 
 
-    sub.m_indices = std::move(newindices);
-    sub.m_indicesCount = (int)sub.m_indices.size();
+    sub.setIndices(std::move(newindices));
 
 
 }
\ No newline at end of file
@@ -2,9 +2,21 @@
 
 #include "Except.h"
 #include "InputOutput.h"
+#include "Profile.h"
 
 #include <functional>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  #include <arm_neon.h>
+  #define USE_NEON
+#endif
 
 using namespace std;
 
@@ -24,6 +36,13 @@ void Mesh::clear()
     m_rootChunk.reset();
     m_headerBuf.clear();
     m_materials.clear();
+    m_sharedGeom.reset();
+    m_passThroughIds.clear();
+    m_morphKeys.clear();
+    m_poses.clear();
+    m_edgeLists.clear();
+    m_source.reset();
+    m_swappedOrder = false;
 }
 
 
@@ -54,7 +73,7 @@ public:
             topid = tos->id;
             if (FuncIsSubChunk(topid, id))
                 break;
-            tos->size = tos->consumedSize;
+            fixSize(tos.get());
             m_stack.pop_back();
         }
         CHECK(!m_stack.empty(), "Unexpected chunk id in tree " << topid);
@@ -75,18 +94,33 @@ public:
         consumeSize((int)buf.size());
     }
 
+    // chunks that are still in the stack at the end were never popped so their size was not fixed yet
     void checkDone() {
-
+        for(const auto& chunk: m_stack)
+            fixSize(chunk.get());
+    }
+    // a chunk with a wrong size in the file can't be copied from it as is
+    void fixSize(Chunk* chunk) {
+        chunk->size = chunk->consumedSize;
+        if (chunk->size != chunk->origSize)
+            chunk->touch();
     }
     vector<shared_ptr<Chunk>> m_stack;
 };
 
 
 
+// the file stays mapped so that saving can copy the chunks that did not change
 void Mesh::parse(const string& filename, ostream* out) {
-    ifstream inf(filename.c_str(), ios::binary);
-    CHECK(inf.good(), "Failed reading file `" << filename << "`");
+    auto view = make_shared<FileView>(filename);
+    if (isSnapshot(view->data(), view->size())) {
+        loadSnapshot(view->data(), view->size());
+        return;
+    }
+    MemIStream inf(view->data(), view->size());
     parse(inf, out);
+    if (!m_swappedOrder) // the chunks can't be copied as they are from a file in the other byte order
+        m_source = view;
 }
 
 
@@ -119,7 +153,35 @@ void logn(ostream* os, const Args&... args)
 
 void Mesh::parse(istream& inf, ostream* out)
 {
-    Deserializer s(inf);
+    // a mesh starts with a 0 byte of the header id, a snapshot with its magic
+    if (inf.peek() == 'O') {
+        string data((istreambuf_iterator<char>(inf)), istreambuf_iterator<char>());
+        CHECK(isSnapshot(data.data(), data.size()), "Not a mesh or a snapshot");
+        loadSnapshot(data.data(), data.size());
+        return;
+    }
+    clear(); // the same object may be used for parsing several meshes
+    ScopedPhase phase("parse");
+
+    // the header id of a file written in the other byte order reads as 0x0010. such a file is copied so
+    // it can be converted to the native order in place as it's parsed
+    ushort firstId = 0;
+    inf.read((char*)&firstId, sizeof(firstId));
+    inf.clear();
+    inf.seekg(0);
+    string swapData;
+    unique_ptr<MemIStream> swapIn;
+    if (firstId == 0x0010) {
+        inf.seekg(0, ios_base::end);
+        swapData.resize((size_t)inf.tellg());
+        inf.seekg(0);
+        inf.read(&swapData[0], swapData.size());
+        CHECK(inf.good(), "failed reading from stream");
+        swapIn.reset(new MemIStream(swapData.data(), swapData.size()));
+        m_swappedOrder = true;
+    }
+    Deserializer s(swapIn ? *swapIn : inf, swapIn ? &swapData[0] : nullptr);
+    phase.setBytes(s.remainSize());
 
     // read header
     ushort headerid = s.read16();
@@ -248,12 +310,336 @@ void Mesh::parseSkeleton(Deserializer& s, ostream* out, int fileVer)
     chunkStack.checkDone();
 }
 
+// widen 16 bit indices to 32 bit, 8 at a time
+static void widenIndices(const ushort* src, uint* dst, size_t count)
+{
+    size_t i = 0;
+#if defined(USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(v, zero));
+    }
+#elif defined(USE_NEON)
+    for(; i + 8 <= count; i += 8) {
+        uint16x8_t v = vld1q_u16(src + i);
+        vst1q_u32(dst + i, vmovl_u16(vget_low_u16(v)));
+        vst1q_u32(dst + i + 4, vmovl_u16(vget_high_u16(v)));
+    }
+#endif
+    for(; i < count; ++i)
+        dst[i] = src[i];
+}
+
+// shuffles within every 16 bytes, 8 or 4 values at a time
+void byteSwap16(void* data, size_t count)
+{
+    ushort* p = (ushort*)data;
+    size_t i = 0;
+#if defined(USE_SSE2)
+    for(; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        _mm_storeu_si128((__m128i*)(p + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#elif defined(USE_NEON)
+    for(; i + 8 <= count; i += 8)
+        vst1q_u8((uint8_t*)(p + i), vrev16q_u8(vld1q_u8((const uint8_t*)(p + i))));
+#endif
+    for(; i < count; ++i)
+        p[i] = (ushort)((p[i] << 8) | (p[i] >> 8));
+}
+
+void byteSwap32(void* data, size_t count)
+{
+    uint* p = (uint*)data;
+    size_t i = 0;
+#if defined(USE_SSE2)
+    for(; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // the bytes in every half
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)); // then the halves
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(p + i), v);
+    }
+#elif defined(USE_NEON)
+    for(; i + 4 <= count; i += 4)
+        vst1q_u8((uint8_t*)(p + i), vrev32q_u8(vld1q_u8((const uint8_t*)(p + i))));
+#endif
+    for(; i < count; ++i)
+        p[i] = (p[i] << 24) | ((p[i] << 8) & 0xff0000) | ((p[i] >> 8) & 0xff00) | (p[i] >> 24);
+}
+
+// the values of every entry are swapped by their size. when all of them are 4 bytes, which is the usual
+// float and colour vertex, the buffer is swapped as one array
+static void swapVertexBuffer(const VtxBind& bind, char* data, size_t vertexCount)
+{
+    bool all32 = true;
+    for(const auto& e: bind.e)
+        all32 &= (componentSize(e.type) == 4);
+    if (all32) {
+        byteSwap32(data, vertexCount * bind.entriesSize / 4);
+        return;
+    }
+    for(size_t i = 0; i < vertexCount; ++i) {
+        char* vtx = data + i * bind.entriesSize;
+        for(const auto& e: bind.e) {
+            int size = componentSize(e.type);
+            if (size == 4)
+                byteSwap32(vtx + e.offset, typeSize(e.type) / 4);
+            else if (size == 2)
+                byteSwap16(vtx + e.offset, typeSize(e.type) / 2);
+        }
+    }
+}
+
+// decode a raw index buffer from the file into 32 bit indices
+static void decodeIndices(const string& data, bool is32bit, vector<uint>* outIndices)
+{
+    if (is32bit) {
+        outIndices->resize(data.size() / sizeof(uint));
+        if (!data.empty())
+            memcpy(outIndices->data(), data.data(), data.size());
+    }
+    else {
+        outIndices->resize(data.size() / sizeof(ushort));
+        widenIndices((const ushort*)data.data(), outIndices->data(), outIndices->size());
+    }
+}
+
+// largest index in the buffer, used for validating against the vertex count
+static uint maxIndex(const vector<uint>& indices)
+{
+    const uint* p = indices.data();
+    size_t count = indices.size(), i = 0;
+    uint maxv = 0;
+#if defined(USE_SSE2)
+    // SSE2 has no unsigned 32 bit compare, flip the sign bit and compare signed
+    const __m128i bias = _mm_set1_epi32((int)0x80000000);
+    __m128i vmax = bias;
+    for(; i + 4 <= count; i += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i)), bias);
+        __m128i gt = _mm_cmpgt_epi32(v, vmax);
+        vmax = _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, vmax));
+    }
+    uint lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, _mm_xor_si128(vmax, bias));
+    for(int j = 0; j < 4; ++j)
+        maxv = std::max(maxv, lanes[j]);
+#elif defined(USE_NEON)
+    uint32x4_t vmax = vdupq_n_u32(0);
+    for(; i + 4 <= count; i += 4)
+        vmax = vmaxq_u32(vmax, vld1q_u32(p + i));
+    maxv = vmaxvq_u32(vmax);
+#endif
+    for(; i < count; ++i)
+        maxv = std::max(maxv, p[i]);
+    return maxv;
+}
+
+// reference decoding of a single vertex element from the raw buffer
+static void decodeElement(const char* p, const VtxEntry& e, float vf[4], uint* vi)
+{
+    switch(e.type) {
+    case VET_FLOAT1:
+    case VET_FLOAT2:
+    case VET_FLOAT3:
+    case VET_FLOAT4:
+        memcpy(vf, p, typeSize(e.type));
+        break;
+    case VET_COLOUR_ABGR:
+    case VET_COLOUR_ARGB:
+        memcpy(vi, p, sizeof(uint));
+        break;
+    default:
+        throw Exception("Unsupported vertex type");
+    }; // type switch
+}
+
+static void assignElement(VtxInfo& vtx, const VtxEntry& e, float* vf, uint vi)
+{
+    switch(e.sem)
+    {
+    case VES_POSITION: vtx.pos.set(e.type, vf); break;
+    case VES_NORMAL:   vtx.normal.set(e.type, vf); break;
+    case VES_TANGENT:  vtx.tangent.set(e.type, vf); break;
+    case VES_BINORMAL: vtx.binormal.set(e.type, vf); break;
+    case VES_TEXTURE_COORDINATES:
+        vtx.tex[e.index].set(e.type, vf);
+        break;
+    case VES_DIFFUSE:
+        CHECK(e.type == VET_COLOUR_ABGR || e.type == VET_COLOUR_ARGB, "unexpected diffuse type");
+        vtx.diffuse = vi;
+        break;
+    default:
+        throw Exception("Unexpected sematic");
+    }
+}
+
+static void logVertex(ostream* out, const VtxBind& bind, const char* vdata)
+{
+    for(const auto& e: bind.e)
+    {
+        LOGN(string(e.name).substr(4,3), ":");
+        float vf[4] = {0};
+        uint vi = 0;
+        decodeElement(vdata + e.offset, e, vf, &vi);
+        if (e.type >= VET_FLOAT1 && e.type <= VET_FLOAT4) {
+            int count = e.type - VET_FLOAT1 + 1;
+            LOGN("(");
+            for(int j = 0; j < count; ++j)
+                LOGN(vf[j], ((j < count-1) ? ", " : ")"));
+        }
+        else
+            LOGN(hex, "0x", vi, dec);
+        LOGN("\t");
+    }
+}
+
+// the field of VtxInfo that an entry is decoded into
+static void* fieldOf(VtxInfo& vtx, const VtxEntry& e)
+{
+    switch(e.sem)
+    {
+    case VES_POSITION: CHECK(e.type == VET_FLOAT3, "expected FLOAT3 type"); return &vtx.pos;
+    case VES_NORMAL:   CHECK(e.type == VET_FLOAT3, "expected FLOAT3 type"); return &vtx.normal;
+    case VES_TANGENT:  CHECK(e.type == VET_FLOAT3, "expected FLOAT3 type"); return &vtx.tangent;
+    case VES_BINORMAL: CHECK(e.type == VET_FLOAT3, "expected FLOAT3 type"); return &vtx.binormal;
+    case VES_TEXTURE_COORDINATES:
+        CHECK(e.type == VET_FLOAT2, "expected FLOAT2 type");
+        return &vtx.tex[e.index];
+    case VES_DIFFUSE:
+        CHECK(e.type == VET_COLOUR_ABGR || e.type == VET_COLOUR_ARGB, "unexpected diffuse type");
+        return &vtx.diffuse;
+    default:
+        throw Exception("Unexpected sematic");
+    }
+}
+
+// a vertex declaration compiled once into a list of copies from the raw vertex to VtxInfo fields,
+// instead of switching on the type and semantic of every element of every vertex
+struct VtxDecodePlan
+{
+    struct Step {
+        int srcOffset; // offset of the element in the raw vertex
+        int dstOffset; // offset of the field in VtxInfo
+        int size;      // bytes to copy
+    };
+
+    VtxDecodePlan(const VtxBind& bind) : vertexSize(bind.entriesSize), m_bind(bind)
+    {
+        VtxInfo dummy;
+        for(const auto& e: bind.e) {
+            int dst = (int)((char*)fieldOf(dummy, e) - (char*)&dummy);
+            steps.push_back(Step{e.offset, dst, typeSize(e.type)});
+        }
+    }
+    // does the declaration consist of exactly these {semantic, type} pairs, in order (semantic index 0)
+    bool isLayout(const vector<pair<int, ushort>>& semTypes) const {
+        if (semTypes.size() != m_bind.e.size())
+            return false;
+        for(size_t i = 0; i < semTypes.size(); ++i) {
+            const auto& e = m_bind.e[i];
+            if (e.sem != semTypes[i].first || e.type != semTypes[i].second || e.index != 0)
+                return false;
+        }
+        return true;
+    }
+
+    vector<Step> steps;
+    int vertexSize;
+    const VtxBind& m_bind;
+};
+
+// specialized kernel for the common layouts POS3 [+NRM3] [+UV2], all copies have a fixed size
+template<int NRM_OFFSET, int UV_OFFSET, int VSIZE>
+static void decodeFixed(const char* data, vector<VtxInfo>& vtxs)
+{
+    for(size_t i = 0; i < vtxs.size(); ++i, data += VSIZE) {
+        VtxInfo& vtx = vtxs[i];
+        vtx.index = (int)i;
+        memcpy(&vtx.pos, data, sizeof(Vec3));
+        if (NRM_OFFSET >= 0)
+            memcpy(&vtx.normal, data + NRM_OFFSET, sizeof(Vec3));
+        if (UV_OFFSET >= 0)
+            memcpy(&vtx.tex[0], data + UV_OFFSET, sizeof(Vec2));
+        vtx.selfBufs.push_back(string(data, VSIZE));
+    }
+}
+
+static void decodeGeneric(const char* data, const VtxDecodePlan& plan, vector<VtxInfo>& vtxs)
+{
+    for(size_t i = 0; i < vtxs.size(); ++i, data += plan.vertexSize) {
+        VtxInfo& vtx = vtxs[i];
+        vtx.index = (int)i;
+        for(const auto& step: plan.steps)
+            memcpy((char*)&vtx + step.dstOffset, data + step.srcOffset, step.size);
+        vtx.selfBufs.push_back(string(data, plan.vertexSize));
+    }
+}
+
+// decode the data of a whole vertex buffer into m_vtx
+void SubMesh::decodeVertexBuffer(const char* data, size_t size, int bindIndex)
+{
+    const auto& bind = m_entries[bindIndex];
+    CHECK(size == (size_t)m_vertexCount * bind.entriesSize, "Unexpected vertex buffer size");
+    CHECK(m_vtx.size() == (size_t)m_vertexCount, "vertex count inconsistant");
+    if (m_vtx.empty())
+        return;
+    CHECK(m_vtx.front().selfBufs.size() == (size_t)bindIndex && m_vtx.back().selfBufs.size() == (size_t)bindIndex, "Unexpected selfBufs size");
+
+    VtxDecodePlan plan(bind);
+    if (plan.isLayout({ {VES_POSITION, VET_FLOAT3}, {VES_NORMAL, VET_FLOAT3}, {VES_TEXTURE_COORDINATES, VET_FLOAT2} }))
+        decodeFixed<12, 24, 32>(data, m_vtx);
+    else if (plan.isLayout({ {VES_POSITION, VET_FLOAT3}, {VES_TEXTURE_COORDINATES, VET_FLOAT2} }))
+        decodeFixed<-1, 12, 20>(data, m_vtx);
+    else if (plan.isLayout({ {VES_POSITION, VET_FLOAT3}, {VES_NORMAL, VET_FLOAT3} }))
+        decodeFixed<12, -1, 24>(data, m_vtx);
+    else
+        decodeGeneric(data, plan, m_vtx);
+
+#ifdef DEBUG
+    checkDecode(bindIndex);
+#endif
+}
+
+// validate the decoded vertices of a buffer against the reference decoder, using the raw data kept in selfBufs
+void SubMesh::checkDecode(int bindIndex)
+{
+    const auto& bind = m_entries[bindIndex];
+    for(size_t i = 0; i < m_vtx.size(); ++i) {
+        const char* vdata = m_vtx[i].selfBufs[bindIndex].data();
+        VtxInfo ref = m_vtx[i];
+        for(const auto& e: bind.e) {
+            float vf[4] = {0};
+            uint vi = 0;
+            decodeElement(vdata + e.offset, e, vf, &vi);
+            assignElement(ref, e, vf, vi);
+            CHECK(memcmp(fieldOf(ref, e), fieldOf(m_vtx[i], e), typeSize(e.type)) == 0, "Vertex decode mismatch at " << i);
+        }
+    }
+}
+
+void Mesh::checkDecode()
+{
+    if (m_sharedGeom.get() != nullptr) {
+        for(size_t b = 0; b < m_sharedGeom->m_entries.size(); ++b)
+            m_sharedGeom->checkDecode((int)b);
+    }
+    for(auto& sub: m_sub) {
+        for(size_t b = 0; b < sub.m_entries.size(); ++b)
+            sub.checkDecode((int)b);
+    }
+}
+
 // based on OgreMeshFileFormat.h
 void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
 {
 
     m_rootChunk.reset(new Chunk(0, s.remainSize()));
     ChunkStack<isMeshSubChunk> chunkStack(m_rootChunk);
+    m_fileVer = fileVer;
+    int animTarget = -1; // target of the current animation track
 
 
     while (!s.eof())
@@ -264,6 +650,7 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
         LOG("CHUNK ", hex, id, " ", meshChunkName(id), " (", dec, chunkLen, " bytes)");
 
         shared_ptr<Chunk> curChunk = chunkStack.push(id, chunkLen);
+        curChunk->fileOffset = s.chunkStart();
 
         switch (id)
         {
@@ -276,6 +663,7 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
         case 0x4000: {  // submesh
             m_sub.push_back(SubMesh());
             m_cursub = &m_sub.back();
+            m_cursub->m_chunk = curChunk;
             m_cursub->m_material = s.readStr();
             m_materials.insert(m_cursub->m_material);
             LOG("  material= ", m_cursub->m_material);
@@ -289,18 +677,23 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
             LOG("  indexCount= ", m_cursub->m_indicesCount);
             m_cursub->m_indices32bit = s.readBool();
             LOG("  index32Bit= ", m_cursub->m_indices32bit);
-            m_cursub->m_indices.reserve(m_cursub->m_indicesCount);
+            // read the whole index buffer at once and widen it
+            string data;
+            size_t idxSize = m_cursub->m_indices32bit ? sizeof(uint) : sizeof(ushort);
+            CHECK((size_t)m_cursub->m_indicesCount * idxSize <= (size_t)s.remainSize(), "Index buffer larger than the file");
+            data.resize(m_cursub->m_indicesCount * idxSize);
+            if (m_cursub->m_indices32bit)
+                s.readBuf32(&data[0], m_cursub->m_indicesCount);
+            else
+                s.readBuf16(&data[0], m_cursub->m_indicesCount);
+            decodeIndices(data, m_cursub->m_indices32bit, &m_cursub->m_indices);
             LOGN("  indexes=");
-            for (uint i = 0; i < m_cursub->m_indicesCount; ++i) {
-                if ((i % 20) == 0)
-                    LOGN("\n    ");
-                uint idx;
-                if (m_cursub->m_indices32bit)
-                    idx = s.read32();
-                else
-                    idx = s.read16();
-                LOGN(idx, " ");
-                m_cursub->m_indices.push_back(idx);
+            if (out != nullptr) {
+                for (uint i = 0; i < m_cursub->m_indicesCount; ++i) {
+                    if ((i % 20) == 0)
+                        LOGN("\n    ");
+                    LOGN(m_cursub->m_indices[i], " ");
+                }
             }
             LOG(""); // end the line
             break;
@@ -389,78 +782,26 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
             break;
         }
         case 0x5210: { // M_GEOMETRY_VERTEX_BUFFER_DATA
+            const auto& bind = m_cursub->m_entries[m_cursub->m_vertexBind];
+            // read the whole buffer at once and decode it from memory
+            string data;
+            data.resize((size_t)m_cursub->m_vertexCount * bind.entriesSize);
+            s.readBuf(data);
+            if (s.swapped()) {
+                swapVertexBuffer(bind, &data[0], m_cursub->m_vertexCount);
+                s.replaceLast(data.data(), data.size());
+            }
+
             LOGN("  vertices=");
-            for(int i = 0; i < m_cursub->m_vertexCount; ++i)
-            {
-                bool doOut = m_outAllVertices || (i == 0) || (i == m_cursub->m_vertexCount - 1);
-                if (doOut)
-                    LOGN("\n    ", i, "> ");
-                VtxInfo & vtx = m_cursub->m_vtx[i];
-                vtx.index = i;
-
-                int startOffset = s.tellg();
-
-                for(const auto& e: m_cursub->m_entries[m_cursub->m_vertexBind].e)
-                {
-                    if (doOut)
-                        LOGN(string(e.name).substr(4,3), ":");
-                    float vf[4] = {0};
-                    uint vi = 0;
-                    switch(e.type) {
-                    case VET_FLOAT1:
-                    case VET_FLOAT2:
-                    case VET_FLOAT3:
-                    case VET_FLOAT4: {
-                        int count = e.type - VET_FLOAT1 + 1;
-                        if (doOut)
-                            LOGN("(");
-                        for(int j = 0; j < count; ++j) {
-                            vf[j] = s.read32f();
-                            if (doOut)
-                                LOGN(vf[j], ((j < count-1) ? ", " : ")"));
-                        }
-                        break;
+            if (out != nullptr) {
+                for(int i = 0; i < m_cursub->m_vertexCount; ++i) {
+                    if (m_outAllVertices || (i == 0) || (i == m_cursub->m_vertexCount - 1)) {
+                        LOGN("\n    ", i, "> ");
+                        logVertex(out, bind, data.data() + i * bind.entriesSize);
                     }
-                    case VET_COLOUR_ABGR:
-                    case VET_COLOUR_ARGB:
-                        vi = s.read32();
-                        if (doOut)
-                            LOGN(hex, "0x", vi, dec);
-                        break;
-                    default:
-                        throw Exception("Unsupported vertex type");
-                    }; // type switch
-                    if (doOut)
-                        LOGN("\t");
-
-                    //CHECK(!vtx.has[e.sem], "Vertex already has this semantic"); // can happen with multiple sematics with indices
-                    switch(e.sem)
-                    {
-                    case VES_POSITION: vtx.pos.set(e.type, vf); break;
-                    case VES_NORMAL:   vtx.normal.set(e.type, vf); break;
-                    case VES_TANGENT:  vtx.tangent.set(e.type, vf); break;
-                    case VES_BINORMAL: vtx.binormal.set(e.type, vf); break;
-                    case VES_TEXTURE_COORDINATES:
-                        vtx.tex[e.index].set(e.type, vf);
-                        break;
-                    case VES_DIFFUSE:
-                        CHECK(e.type == VET_COLOUR_ABGR || e.type == VET_COLOUR_ARGB, "unexpected diffuse type");
-                        vtx.diffuse = vi;
-                        break;
-                    default:
-                        throw Exception("Unexpected sematic");
-                    }
-                    //vtx.has[e.sem] = true;
-
                 }
-
-                int endOffset = s.tellg();
-                CHECK(endOffset - startOffset == m_cursub->m_entries[m_cursub->m_vertexBind].entriesSize, "Unexpected entry size");
-                CHECK(vtx.selfBufs.size() == m_cursub->m_vertexBind, "Unexpected selfBufs size");
-                vtx.selfBufs.push_back(s.getSubBuf(startOffset, endOffset));
-
-
             }
+            m_cursub->decodeVertexBuffer(data.data(), data.size(), m_cursub->m_vertexBind);
             LOG("");
             break;
         }
@@ -488,54 +829,66 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
             m_cursub->m_hasEdges = true;
             break;
         case 0xb100: { // M_EDGE_LIST_LOD
-            LOG("  lodIndex= ", s.read16());
-            bool isManual = s.readBool();
-            LOG("  isManual= ", isManual);
-            if (!isManual) {
-                LOG("  isClosed= ", s.readBool());
+            m_edgeLists.push_back(EdgeListLod());
+            auto& el = m_edgeLists.back();
+            el.chunk = curChunk;
+            el.lodIndex = s.read16();
+            LOG("  lodIndex= ", el.lodIndex);
+            el.isManual = s.readBool();
+            LOG("  isManual= ", el.isManual);
+            if (!el.isManual) {
+                el.isClosed = s.readBool();
+                LOG("  isClosed= ", el.isClosed);
                 uint numTriangles = s.read32();
                 LOG("  numTriangles= ", numTriangles);
                 uint numEdgeGroups = s.read32(); // the number of subsequent chunks for groups
                 LOG("  numEdgeGroups= ", numEdgeGroups);
-                for(uint i = 0; i < numTriangles; ++i) {
-                    uint indexSet = s.read32();
-                    uint vertexSet = s.read32();
-                    uint vertIndex[3], sharedVertIndex[3];
-                    LOGN("    TRI: iset=", indexSet, " vset=", vertexSet, " idx=");
-                    for(int j = 0; j < 3; ++j) {
-                        vertIndex[j] = s.read32();
-                        LOGN(vertIndex[j], ",");
+                CHECK((size_t)numTriangles * sizeof(EdgeTriangle) <= (size_t)s.remainSize(), "Edge list larger than the file");
+                el.tris.resize(numTriangles);
+                s.readBuf32(el.tris.data(), el.tris.size() * sizeof(EdgeTriangle) / 4);
+                if (out != nullptr) {
+                    for(const auto& t: el.tris) {
+                        LOGN("    TRI: iset=", t.indexSet, " vset=", t.vertexSet, " idx=");
+                        for(int j = 0; j < 3; ++j)
+                            LOGN(t.vertIndex[j], ",");
+                        LOGN("  sharedIdx=");
+                        for(int j = 0; j < 3; ++j)
+                            LOGN(t.sharedVertIndex[j], ",");
+                        LOGN("  normal=");
+                        for(int j = 0; j < 4; ++j)
+                            LOGN(t.normal[j], ",");
+                        LOG("");
                     }
-                    LOGN("  sharedIdx=");
-                    for(int j = 0; j < 3; ++j) {
-                        sharedVertIndex[j] = s.read32();
-                        LOGN(sharedVertIndex[j], ",");
-                    }
-                    LOGN("  normal=");
-                    float normal[4];
-                    for(int j = 0; j < 4; ++j) {
-                        normal[j] = s.read32f();
-                        LOGN(normal[j], ",");
-                    }
-                    LOG("");
                 }
             }
             break;
         }
         case 0xb110: { // M_EDGE_GROUP
-            LOGN("  vertexSet=", s.read32());
-            LOGN("  triStart=", s.read32());
-            LOGN("  triCount=", s.read32());
+            CHECK(!m_edgeLists.empty(), "missing edge list");
+            m_edgeLists.back().groups.push_back(EdgeGroup());
+            auto& g = m_edgeLists.back().groups.back();
+            g.vertexSet = s.read32();
+            LOGN("  vertexSet=", g.vertexSet);
+            g.triStart = s.read32();
+            LOGN("  triStart=", g.triStart);
+            g.triCount = s.read32();
+            LOGN("  triCount=", g.triCount);
             uint numEdges = s.read32();
             LOG("  numEdges=", numEdges);
-            for(uint i = 0; i < numEdges; ++i) {
-                LOGN("    EDGE: triIdx=", s.read32());
-                LOGN(",", s.read32());
-                LOGN("  vertIdx=", s.read32());
-                LOGN(",", s.read32());
-                LOGN("  shaderVertIdx=", s.read32());
-                LOGN(",", s.read32());
-                LOG("   degenerate=", s.readBool());
+            CHECK((size_t)numEdges * 25 <= (size_t)s.remainSize(), "Edge group larger than the file");
+            g.edges.resize(numEdges);
+            for(auto& e: g.edges) {
+                e.triIndex[0] = s.read32();
+                e.triIndex[1] = s.read32();
+                e.vertIndex[0] = s.read32();
+                e.vertIndex[1] = s.read32();
+                e.sharedVertIndex[0] = s.read32();
+                e.sharedVertIndex[1] = s.read32();
+                e.degenerate = s.readBool();
+                LOGN("    EDGE: triIdx=", e.triIndex[0], ",", e.triIndex[1]);
+                LOGN("  vertIdx=", e.vertIndex[0], ",", e.vertIndex[1]);
+                LOGN("  shaderVertIdx=", e.sharedVertIndex[0], ",", e.sharedVertIndex[1]);
+                LOG("   degenerate=", e.degenerate);
             }
             break;
         }
@@ -550,30 +903,74 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
             LOG("  baseAnimationName=", s.readStr());
             LOG("  baseKeyFrameTime=", s.read32f());
             break;
+        case 0xc000: // M_POSES no data for this
+            break;
+        case 0xc100: { // M_POSE
+            m_poses.push_back(Pose());
+            auto& pose = m_poses.back();
+            LOG("  name=", s.readStr());
+            pose.target = s.read16();
+            LOG("  target=", pose.target);
+            animTargetGeom(pose.target); // validate
+            pose.hasNormals = false;
+            if (fileVer >= 180) {
+                pose.hasNormals = s.readBool(); // 1.8+ only
+                LOG("  includesNormals=", pose.hasNormals);
+            }
+            break;
+        }
+        case 0xc111: { // M_POSE_VERTEX
+            CHECK(!m_poses.empty(), "missing pose");
+            auto& pose = m_poses.back();
+            pose.vtx.push_back(PoseVertex());
+            auto& pv = pose.vtx.back();
+            pv.vertexIndex = s.read32();
+            CHECK(pv.vertexIndex < (uint)animTargetGeom(pose.target)->m_vertexCount, "Pose vertex index out of range");
+            pv.offset.x = s.read32f();
+            pv.offset.y = s.read32f();
+            pv.offset.z = s.read32f();
+            pv.normal.clear();
+            LOGN("  vertexIndex=", pv.vertexIndex, "  offset=", pv.offset);
+            if (pose.hasNormals) {
+                pv.normal.x = s.read32f();
+                pv.normal.y = s.read32f();
+                pv.normal.z = s.read32f();
+                LOGN("  normal=", pv.normal);
+            }
+            LOG("");
+            pv.chunk = curChunk;
+            break;
+        }
         case 0xd110: // M_ANIMATION_TRACK
             LOG("  type=", s.read16());
-            LOG("  target=", s.read16());
+            animTarget = s.read16();
+            LOG("  target=", animTarget);
             break;
         case 0xd111: { // M_ANIMATION_MORPH_KEYFRAME
-            LOG("  time=", s.read32f());
-            bool hasNormals = false;
+            m_morphKeys.push_back(MorphKeyframe());
+            auto& key = m_morphKeys.back();
+            key.target = animTarget;
+            key.chunk = curChunk;
+            key.time = s.read32f();
+            LOG("  time=", key.time);
+            key.hasNormals = false;
             if (fileVer >= 180) {
-                hasNormals = s.readBool(); // 1.8+ only
-                LOG("  includesNormals=", hasNormals);
+                key.hasNormals = s.readBool(); // 1.8+ only
+                LOG("  includesNormals=", key.hasNormals);
             }
-            for(int i = 0; i < m_cursub->m_vertexCount; ++i)  { // using vertexCount here is wrong
-                Vec3 vtx, normal;
-                vtx.x = s.read32f();
-                vtx.y = s.read32f();
-                vtx.z = s.read32f();
-                LOGN("    ", i, "> POS=", vtx);
-                if (hasNormals) {
-                    normal.x = s.read32f();
-                    normal.y = s.read32f();
-                    normal.z = s.read32f();
-                    LOGN("    NORMAL=", normal);
+            // one position (and normal) for every vertex of the track target geometry
+            int vertexCount = animTargetGeom(animTarget)->m_vertexCount;
+            key.data.resize((size_t)vertexCount * key.floatsPerVtx());
+            CHECK(key.data.size() * sizeof(float) <= (size_t)s.remainSize(), "Morph keyframe larger than the file");
+            s.readBuf32(key.data.data(), key.data.size());
+            if (out != nullptr) {
+                for(int i = 0; i < vertexCount; ++i)  {
+                    const float* v = &key.data[i * key.floatsPerVtx()];
+                    LOGN("    ", i, "> POS=", Vec3{v[0], v[1], v[2]});
+                    if (key.hasNormals)
+                        LOGN("    NORMAL=", Vec3{v[3], v[4], v[5]});
+                    LOG("");
                 }
-                LOG("");
             }
             break;
         }
@@ -586,8 +983,14 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
             break;
 
         default: {
-            int cur = s.tellg();
-            CHECK(false, "Unsupported id at " << cur);
+            // valid in the tree (ChunkStack checked it) but not parsed here, like LOD, poses and extremes.
+            // consume it with all its sub-chunks by its length so it is saved back byte for byte
+            int contentLen = chunkLen - 6;
+            CHECK(contentLen >= 0 && contentLen <= s.remainSize(), "Bad length " << chunkLen << " of unsupported id " << hex << id << dec << " at " << s.tellg());
+            CHECK(!s.swapped(), "Unsupported id " << hex << id << dec << " can't be converted from the other byte order");
+            s.skip(contentLen);
+            m_passThroughIds.insert(id);
+            LOG("  passed through ", contentLen, " bytes");
         }
         } // switch
 
@@ -598,6 +1001,17 @@ void Mesh::parseMesh(Deserializer& s, ostream* out, int fileVer)
     }
     chunkStack.checkDone();
 
+    // indices are read before the geometry of their submesh so they can only be validated at the end
+    for(const auto& sub: m_sub) {
+        const SubMesh* geom = sub.m_isSharedGeom ? m_sharedGeom.get() : &sub;
+        if (sub.m_indices.empty())
+            continue;
+        // geom is set, a submesh that uses shared geometry was checked to have it when it was parsed
+        uint maxi = maxIndex(sub.m_indices);
+        CHECK(maxi < (uint)geom->m_vertexCount, "Index " << maxi << " out of range of " << geom->m_vertexCount << " vertices");
+    }
+
+
 }
 
 struct SaveState
@@ -606,6 +1020,14 @@ struct SaveState
     {}
 
     void recSave(Serializer& s, const shared_ptr<Chunk>& chunk);
+    void checkDone();
+
+private:
+    void enter(const shared_ptr<Chunk>& chunk);
+    void leave(const shared_ptr<Chunk>& chunk);
+    void skip(const shared_ptr<Chunk>& chunk);
+    bool writeContent(Serializer& s, const shared_ptr<Chunk>& chunk);
+    SubMesh* indexedGeom(); // the geometry the indices of the current submesh refer to
 
     Mesh& m_mesh;
 
@@ -613,25 +1035,35 @@ struct SaveState
     SubMesh* m_cursub = nullptr;
     int m_bindIndex = -1;
 
-    int m_writeEntryBind = 0; // bind of the next entry that needs to be written
-    int m_writeEntryIndex = 0; // next entry that needs to be written
+    size_t m_writeEntryBind = 0; // bind of the next entry that needs to be written
+    size_t m_writeEntryIndex = 0; // next entry that needs to be written
     int m_writeEntryOffset = 0; // offset in buffer of the entry after the one we just wrote, for validation
+    const VtxEntry* m_curEntry = nullptr;
 
     int m_boneAssignIndex = -1; // index of the last bone assignment chunk
+    int m_poseIndex = -1;       // index of the last pose chunk
+    int m_poseVertexIndex = -1; // index of the last pose vertex chunk in the current pose
+    int m_morphKeyIndex = -1;   // index of the last morph keyframe chunk
+    int m_edgeListIndex = -1;   // index of the last edge list chunk
+    int m_edgeGroupIndex = -1;  // index of the last edge group chunk in the current edge list
 };
 
-void SaveState::recSave(Serializer& s, const shared_ptr<Chunk>& chunk)
-{
-    s.write16(chunk->id);
-    s.write32(chunk->size); // fixed size
-
-    m_cursub = m_mesh.m_sharedGeom.get(); // geometry that comes before submesh is the shared geometry
+SubMesh* SaveState::indexedGeom() {
+    if (m_cursub->m_isSharedGeom) {
+        CHECK(m_mesh.m_sharedGeom.get() != nullptr, "Submesh uses shared geometry but there is none");
+        return m_mesh.m_sharedGeom.get();
+    }
+    return m_cursub;
+}
 
-    bool wrote = false;
+// advance the counters to the object this chunk is written from. done for every chunk, also for chunks that are copied
+void SaveState::enter(const shared_ptr<Chunk>& chunk)
+{
     switch (chunk->id)
     {
     case 0x4000: // M_SUBMESH
         ++m_cursubIndex;
+        CHECK((size_t)m_cursubIndex < m_mesh.m_sub.size(), "Unexpected submesh chunk");
         m_cursub = &m_mesh.m_sub[m_cursubIndex];
         m_bindIndex = -1;
 
@@ -639,95 +1071,291 @@ void SaveState::recSave(Serializer& s, const shared_ptr<Chunk>& chunk)
         m_writeEntryIndex = 0;
         m_writeEntryOffset = 0;
         m_boneAssignIndex = -1;
+        break;
+    case 0x4100: // M_SUBMESH_BONE_ASSIGNMENT
+        ++m_boneAssignIndex;
+        CHECK((size_t)m_boneAssignIndex < m_cursub->m_boneAssign.size(), "Unexpected bone assign chunk");
+        break;
+    case 0xc100: // M_POSE
+        ++m_poseIndex;
+        m_poseVertexIndex = -1;
+        CHECK((size_t)m_poseIndex < m_mesh.m_poses.size(), "Unexpected pose chunk");
+        break;
+    case 0xc111: // M_POSE_VERTEX
+        ++m_poseVertexIndex;
+        CHECK((size_t)m_poseVertexIndex < m_mesh.m_poses[m_poseIndex].vtx.size(), "Unexpected pose vertex chunk");
+        break;
+    case 0xb100: // M_EDGE_LIST_LOD
+        ++m_edgeListIndex;
+        m_edgeGroupIndex = -1;
+        CHECK((size_t)m_edgeListIndex < m_mesh.m_edgeLists.size(), "Unexpected edge list chunk");
+        break;
+    case 0xb110: // M_EDGE_GROUP
+        ++m_edgeGroupIndex;
+        CHECK((size_t)m_edgeGroupIndex < m_mesh.m_edgeLists[m_edgeListIndex].groups.size(), "Unexpected edge group chunk");
+        break;
+    case 0xd111: // M_ANIMATION_MORPH_KEYFRAME
+        ++m_morphKeyIndex;
+        CHECK((size_t)m_morphKeyIndex < m_mesh.m_morphKeys.size(), "Unexpected morph keyframe chunk");
+        break;
+    case 0x5000: // M_GEOMETRY
+        if (chunk->parent->id == M_MESH) // geometry that comes before submesh is the shared geometry
+            m_cursub = m_mesh.m_sharedGeom.get();
+        break;
+    case 0x5110: { // M_GEOMETRY_VERTEX_ELEMENT
+        CHECK(m_writeEntryBind < m_cursub->m_entries.size(), "Unexpected bind index");
+        const auto& bind = m_cursub->m_entries[m_writeEntryBind];
+        CHECK(m_writeEntryIndex < bind.e.size(), "Unexpected entry index");
+        m_curEntry = &bind.e[m_writeEntryIndex];
+        CHECK(m_curEntry->offset == m_writeEntryOffset, "Unexpected entry offset");
+        ++m_writeEntryIndex;
+        m_writeEntryOffset += typeSize(m_curEntry->type);
+        if (m_writeEntryIndex == bind.e.size()) {
+            ++m_writeEntryBind;
+            m_writeEntryIndex = 0;
+            m_writeEntryOffset = 0;
+        }
+        break;
+    }
+    case 0x5200: // M_GEOMETRY_VERTEX_BUFFER
+        ++m_bindIndex;
+        CHECK((size_t)m_bindIndex < m_cursub->m_entries.size(), "Unexpected vertex buffer chunk");
+        break;
+    }
+}
+
+// checks that can only be done after the children
+void SaveState::leave(const shared_ptr<Chunk>& chunk)
+{
+    if (chunk->id == 0x5000) { // M_GEOMETRY
+        CHECK(m_writeEntryBind == m_cursub->m_entries.size(), "Not all vertex elements were written");
+        CHECK(m_bindIndex + 1 == (int)m_cursub->m_entries.size(), "Not all vertex buffers were written");
+    }
+}
 
+// a chunk that is copied as is still needs to move the counters
+void SaveState::skip(const shared_ptr<Chunk>& chunk)
+{
+    enter(chunk);
+    for(const auto& child: chunk->sub)
+        skip(child);
+    leave(chunk);
+}
+
+// returns false for chunks that are not written from the model
+bool SaveState::writeContent(Serializer& s, const shared_ptr<Chunk>& chunk)
+{
+    switch (chunk->id)
+    {
+    case 0x4000: // M_SUBMESH
         s.writeStr(m_cursub->m_material);
         s.writeBool(m_cursub->m_isSharedGeom);
         CHECK(m_cursub->m_indicesCount == m_cursub->m_indices.size(), "Modified indicies but not count?");
         s.write32(m_cursub->m_indicesCount);
         s.writeBool(m_cursub->m_indices32bit);
+        if (!m_cursub->m_indices.empty()) {
+            uint maxi = maxIndex(m_cursub->m_indices);
+            CHECK(maxi < (uint)indexedGeom()->m_vertexCount, "Index " << maxi << " out of range of the vertices");
+            CHECK(m_cursub->m_indices32bit || maxi <= 0xffff, "Index " << maxi << " does not fit in 16 bit");
+        }
         for(uint i = 0; i < m_cursub->m_indicesCount; ++i) {
             if (m_cursub->m_indices32bit)
                 s.write32(m_cursub->m_indices[i]);
             else
                 s.write16(m_cursub->m_indices[i]);
         }
-        wrote = true;
-        break;
+        return true;
     case 0x4100: { // M_SUBMESH_BONE_ASSIGNMENT
-        ++m_boneAssignIndex;
-        CHECK(m_boneAssignIndex < m_cursub->m_boneAssign.size(), "Unexpected bone assign chunk");
         const auto& b = m_cursub->m_boneAssign[m_boneAssignIndex];
+        CHECK(b.vertexIndex < (uint)m_cursub->m_vertexCount, "Bone assignment vertex out of range");
         s.write32(b.vertexIndex);
         s.write16(b.boneIndex);
         s.write32f(b.weight);
-        wrote = true;
-        break;
+        return true;
     }
-    case 0x5000: // M_GEOMETRY
-        s.write32(m_cursub->m_vertexCount);
-        wrote = true;
-        break;
-    case 0x5110: { // M_GEOMETRY_VERTEX_ELEMENT
-        CHECK(m_writeEntryBind < m_cursub->m_entries.size(), "Unexpected bind index");
-        const auto& bind = m_cursub->m_entries[m_writeEntryBind];
-        CHECK(m_writeEntryIndex < bind.e.size(), "Unexpected entry index");
-        const auto& entry = bind.e[m_writeEntryIndex];
-        CHECK(entry.offset == m_writeEntryOffset, "Unexpected entry offset");
-        s.write16(entry.source);
-        s.write16(entry.type);
-        s.write16(entry.sem);
-        s.write16(entry.offset);
-        s.write16(entry.index);
-        ++m_writeEntryIndex;
-        m_writeEntryOffset += typeSize(entry.type);
-        if (m_writeEntryIndex == bind.e.size()) {
-            ++m_writeEntryBind;
-            m_writeEntryIndex = 0;
-            m_writeEntryOffset = 0;
+    case 0xc111: { // M_POSE_VERTEX
+        const auto& pose = m_mesh.m_poses[m_poseIndex];
+        const auto& pv = pose.vtx[m_poseVertexIndex];
+        s.write32(pv.vertexIndex);
+        s.write32f(pv.offset.x);
+        s.write32f(pv.offset.y);
+        s.write32f(pv.offset.z);
+        if (pose.hasNormals) {
+            s.write32f(pv.normal.x);
+            s.write32f(pv.normal.y);
+            s.write32f(pv.normal.z);
         }
-        wrote = true;
-        break;
+        return true;
+    }
+    case 0xb100: { // M_EDGE_LIST_LOD
+        const auto& el = m_mesh.m_edgeLists[m_edgeListIndex];
+        s.write16(el.lodIndex);
+        s.writeBool(el.isManual);
+        if (!el.isManual) {
+            s.writeBool(el.isClosed);
+            s.write32((uint)el.tris.size());
+            s.write32((uint)el.groups.size());
+            s.write(el.tris.data(), el.tris.size() * sizeof(EdgeTriangle));
+        }
+        return true;
     }
+    case 0xb110: { // M_EDGE_GROUP
+        const auto& g = m_mesh.m_edgeLists[m_edgeListIndex].groups[m_edgeGroupIndex];
+        s.write32(g.vertexSet);
+        s.write32(g.triStart);
+        s.write32(g.triCount);
+        s.write32((uint)g.edges.size());
+        for(const auto& e: g.edges) {
+            s.write32(e.triIndex[0]);
+            s.write32(e.triIndex[1]);
+            s.write32(e.vertIndex[0]);
+            s.write32(e.vertIndex[1]);
+            s.write32(e.sharedVertIndex[0]);
+            s.write32(e.sharedVertIndex[1]);
+            s.writeBool(e.degenerate);
+        }
+        return true;
+    }
+    case 0xd111: { // M_ANIMATION_MORPH_KEYFRAME
+        const auto& key = m_mesh.m_morphKeys[m_morphKeyIndex];
+        s.write32f(key.time);
+        if (m_mesh.m_fileVer >= 180)
+            s.writeBool(key.hasNormals);
+        s.write(key.data.data(), key.data.size() * sizeof(float));
+        return true;
+    }
+    case 0x5000: // M_GEOMETRY
+        s.write32(m_cursub->m_vertexCount);
+        return true;
+    case 0x5110: // M_GEOMETRY_VERTEX_ELEMENT
+        s.write16(m_curEntry->source);
+        s.write16(m_curEntry->type);
+        s.write16(m_curEntry->sem);
+        s.write16(m_curEntry->offset);
+        s.write16(m_curEntry->index);
+        return true;
     case 0x5200: // M_GEOMETRY_VERTEX_BUFFER
-        ++m_bindIndex;
         s.write16((ushort)m_bindIndex);
         s.write16((ushort)m_cursub->m_entries[m_bindIndex].entriesSize); // might have been updated changing fields
-        wrote = true;
-        break;
+        return true;
     case 0x5210: { // M_GEOMETRY_VERTEX_BUFFER_DATA
+        CHECK(m_cursub->m_vtx.size() == m_cursub->m_vertexCount, "Vertex count does not match vertices");
+        uint vertexSize = m_cursub->m_entries[m_bindIndex].entriesSize;
         for(int i = 0; i < m_cursub->m_vertexCount; ++i) {
-            s.write( m_cursub->m_vtx[i].selfBufs[m_bindIndex] );
+            const auto& buf = m_cursub->m_vtx[i].selfBufs[m_bindIndex];
+            CHECK(buf.size() == vertexSize, "Vertex data does not match the declaration");
+            s.write(buf);
         }
-        wrote = true;
-        break;
+        return true;
     }
     } // switch
+    return false;
+}
+
+// the serialized data is verified as it is written so that there's no need to parse it again
+void SaveState::recSave(Serializer& s, const shared_ptr<Chunk>& chunk)
+{
+    // a chunk that did not change since parse is copied from the source file with all its children
+    if (!chunk->dirty && chunk->fileOffset != -1 && s.canCopy()) {
+        skip(chunk);
+        s.copy(chunk->fileOffset, chunk->size);
+        return;
+    }
+
+    size_t chunkStart = s.tellp();
+    enter(chunk);
+    s.write16(chunk->id);
+    s.write32(chunk->size); // verified below
 
-    // generic write of the chunk content, for chunks that were not written above
-    if (!wrote)
-        s.write(6, chunk->selfBuf);
+    // generic write of the chunk content, for chunks that are not written from the model
+    if (!writeContent(s, chunk))
+        s.write(CHUNK_HEADER_SIZE, chunk->selfBuf);
 
     for(const auto& child: chunk->sub) {
         recSave(s, child);
     }
+    leave(chunk);
+
+    // every edit updates the sizes of the chunks it changes so they should always match what was written
+    uint written = (uint)(s.tellp() - chunkStart);
+    CHECK(written == (uint)chunk->size, "Chunk " << hex << chunk->id << dec << " size " << chunk->size << " does not match written size " << written);
+}
+
+// everything the mesh has was written
+void SaveState::checkDone()
+{
+    CHECK(m_cursubIndex + 1 == (int)m_mesh.m_sub.size(), "Not all submeshes were written");
+    CHECK(m_poseIndex + 1 == (int)m_mesh.m_poses.size(), "Not all poses were written");
+    CHECK(m_morphKeyIndex + 1 == (int)m_mesh.m_morphKeys.size(), "Not all morph keyframes were written");
+    CHECK(m_edgeListIndex + 1 == (int)m_mesh.m_edgeLists.size(), "Not all edge lists were written");
 }
 
 
-void Mesh::save(const string& filename) {
+void Mesh::save(const string& filename)
+{
+    // unchanged chunks go directly from the source file to the output file
+    if (m_source && !m_source->isSameFile(filename)) {
+        string buf;
+        vector<CopyRange> ranges;
+        serialize(&buf, &ranges);
+        ScopedPhase phase("write", buf.size());
+        m_source->writeWithRanges(filename, buf, ranges);
+        return;
+    }
+
+    string buf;
+    serialize(&buf);
+    // overwriting the source file, it can't be used for copying anymore
+    m_source.reset();
+    ScopedPhase phase("write", buf.size());
     ofstream outf(filename, ios::binary);
-    CHECK(outf.good(), "Failed reading file `" << filename << "`");
-    save(outf);
+    CHECK(outf.good(), "Failed opening file `" << filename << "`");
+    outf.write(buf.data(), buf.size());
+    CHECK(outf.good(), "Failed writing mesh");
 }
 
 void Mesh::save(ostream& outf)
 {
-    Serializer s(outf);
+    string buf;
+    serialize(&buf);
+    outf.write(buf.data(), buf.size());
+    CHECK(outf.good(), "Failed writing mesh");
+}
+
+void Mesh::serialize(string* outbuf, vector<CopyRange>* ranges, bool copyUnchanged)
+{
+    ScopedPhase phase("save");
+    outbuf->clear();
+    if (ranges)
+        ranges->clear();
+    Serializer s(*outbuf, copyUnchanged ? m_source.get() : nullptr, ranges);
     s.write(m_headerBuf);
 
     SaveState state(*this);
     for(const auto& child: m_rootChunk->sub) {
         state.recSave(s, child);
     }
+    state.checkDone();
+    phase.setBytes(s.tellp());
+
+#ifdef DEBUG
+    // the copied chunks should be exactly what writing everything from the model gives
+    if (copyUnchanged && m_source) {
+        string copied;
+        size_t bufPos = 0;
+        if (ranges) {
+            for(const auto& r: *ranges) {
+                copied.append(*outbuf, bufPos, r.bufOffset - bufPos);
+                copied.append(m_source->data() + r.srcOffset, r.size);
+                bufPos = r.bufOffset;
+            }
+        }
+        copied.append(*outbuf, bufPos, string::npos);
+        string full;
+        serialize(&full, nullptr, false);
+        CHECK(copied == full, "Copying unchanged chunks gives different output than writing them");
+    }
+#endif
 }
 
 uint Mesh::gatheredEntries() {
@@ -786,6 +1414,20 @@ bool Mesh::hasEdgeList() {
 bool Mesh::hasVertexAnim() {
     return anyOf(m_sub, [](const SubMesh& s) { return s.m_hasVtxAnimation; });
 }
+// passed through chunks that hold vertex indices would be broken by removing vertices
+bool Mesh::hasPassThroughVtxRefs() {
+    return anyOf(m_passThroughIds, [](ushort id) { return id == M_MESH_BONE_ASSIGNMENT || id == M_MESH_LOD; });
+}
+
+// geometry that an animation track or a pose refers to
+SubMesh* Mesh::animTargetGeom(int target) {
+    if (target == 0) {
+        CHECK(m_sharedGeom.get() != nullptr, "Animation target is the shared geometry but there is none");
+        return m_sharedGeom.get();
+    }
+    CHECK(target >= 1 && target <= (int)m_sub.size(), "Unexpected animation target " << target);
+    return &m_sub[target - 1];
+}
 
 void Mesh::statline(ostream& out)
 {
@@ -0,0 +1,545 @@
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include "Mesh.h"
+#include "Profile.h"
+
+using namespace std;
+
+// the snapshot is the in-memory layout of this build, not a portable format. the header rejects
+// snapshots of other versions, byte orders and struct layouts
+#define SNAPSHOT_MAGIC "OGRESNAP"
+#define SNAPSHOT_MAGIC_SIZE 8
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+struct SnapHeader {
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    uint version;
+    uint byteOrder;
+    uint layoutSize; // sum of the sizes of the records, changes when a record changes
+};
+
+// a chunk in pre-order, its own data follows in the chunk data blob
+struct SnapChunk {
+    ushort id;
+    ubyte dirty;
+    int origSize;
+    int size;
+    int consumedSize;
+    int fileOffset;
+    uint numSub;
+    uint selfBufSize;
+};
+
+struct SnapGeom {
+    int vertexSize;
+    int vertexCount;
+    int vertexBind;
+    uint hasEntries;
+    int texCoordCount;
+    uint indicesCount;
+    ubyte hasVtxAnimation;
+    ubyte hasEdges;
+    ubyte indices32bit;
+    ubyte isSharedGeom;
+    int chunk;
+    uint numBinds;
+};
+
+struct SnapBind {
+    int entriesSize;
+    int bufferChunk;
+    uint numEntries;
+};
+
+struct SnapEntry {
+    int source;
+    int offset;
+    ushort type;
+    int sem;
+    int index;
+    int entryChunk;
+};
+
+struct SnapMorphKey {
+    int target;
+    float time;
+    ubyte hasNormals;
+    int chunk;
+};
+
+struct SnapPoseVertex {
+    uint vertexIndex;
+    Vec3 offset;
+    Vec3 normal;
+    int chunk;
+};
+
+struct SnapEdgeList {
+    ushort lodIndex;
+    ubyte isManual;
+    ubyte isClosed;
+    int chunk;
+    uint numGroups;
+};
+
+struct SnapEdgeGroup {
+    uint vertexSet;
+    uint triStart;
+    uint triCount;
+};
+
+struct SnapEdge {
+    uint triIndex[2];
+    uint vertIndex[2];
+    uint sharedVertIndex[2];
+    ubyte degenerate;
+};
+
+static uint snapLayoutSize() {
+    return (uint)(sizeof(SnapChunk) + sizeof(SnapGeom) + sizeof(SnapBind) + sizeof(SnapEntry)
+                  + sizeof(SnapMorphKey) + sizeof(SnapPoseVertex) + sizeof(SnapEdgeList) + sizeof(SnapEdgeGroup)
+                  + sizeof(SnapEdge) + sizeof(BoneAssign) + sizeof(EdgeTriangle));
+}
+
+class SnapWriter
+{
+public:
+    SnapWriter(string& out) : m_out(out)
+    {}
+    template<typename T>
+    void pod(const T& v) {
+        static_assert(is_trivially_copyable<T>::value, "snapshot records are copied as is");
+        m_out.append((const char*)&v, sizeof(T));
+    }
+    // count and then the elements
+    template<typename T>
+    void array(const T* data, size_t count) {
+        static_assert(is_trivially_copyable<T>::value, "snapshot records are copied as is");
+        pod((uint64_t)count);
+        m_out.append((const char*)data, count * sizeof(T));
+    }
+    template<typename T>
+    void array(const vector<T>& v) {
+        array(v.data(), v.size());
+    }
+    void str(const string& s) {
+        array(s.data(), s.size());
+    }
+    void raw(const string& s) {
+        m_out.append(s);
+    }
+private:
+    string& m_out;
+};
+
+class SnapReader
+{
+public:
+    SnapReader(const char* data, size_t size) : m_p(data), m_end(data + size)
+    {}
+    template<typename T>
+    void pod(T* v) {
+        need(sizeof(T));
+        memcpy(v, m_p, sizeof(T));
+        m_p += sizeof(T);
+    }
+    template<typename T>
+    T pod() {
+        T v;
+        pod(&v);
+        return v;
+    }
+    uint64_t count(size_t elemSize) {
+        uint64_t n = pod<uint64_t>();
+        CHECK(elemSize == 0 || n <= (uint64_t)(m_end - m_p) / elemSize, "Snapshot array larger than the file");
+        return n;
+    }
+    template<typename T>
+    void array(vector<T>* v) {
+        v->resize((size_t)count(sizeof(T)));
+        if (!v->empty())
+            read(v->data(), v->size() * sizeof(T));
+    }
+    string str() {
+        string s((size_t)count(1), '\0');
+        if (!s.empty())
+            read(&s[0], s.size());
+        return s;
+    }
+    const char* take(size_t size) {
+        need(size);
+        const char* p = m_p;
+        m_p += size;
+        return p;
+    }
+    void read(void* buf, size_t size) {
+        memcpy(buf, take(size), size);
+    }
+    bool eof() const {
+        return m_p == m_end;
+    }
+private:
+    void need(size_t size) {
+        CHECK(size <= (size_t)(m_end - m_p), "Snapshot is truncated");
+    }
+    const char* m_p;
+    const char* m_end;
+};
+
+typedef unordered_map<const Chunk*, int> ChunkIndices;
+
+static int chunkIndex(const ChunkIndices& indices, const shared_ptr<Chunk>& chunk)
+{
+    if (!chunk)
+        return -1;
+    auto it = indices.find(chunk.get());
+    CHECK(it != indices.end(), "Chunk is not in the tree");
+    return it->second;
+}
+
+static shared_ptr<Chunk> chunkAt(const vector<shared_ptr<Chunk>>& chunks, int index)
+{
+    if (index == -1)
+        return shared_ptr<Chunk>();
+    CHECK(index >= 0 && index < (int)chunks.size(), "Bad chunk index in snapshot");
+    return chunks[index];
+}
+
+static void writeChunks(SnapWriter& w, const shared_ptr<Chunk>& root, ChunkIndices* indices)
+{
+    vector<SnapChunk> recs;
+    string data;
+    function<void(const shared_ptr<Chunk>&)> rec = [&](const shared_ptr<Chunk>& c) {
+        (*indices)[c.get()] = (int)recs.size();
+        SnapChunk sc = {};
+        sc.id = c->id;
+        sc.dirty = c->dirty;
+        sc.origSize = c->origSize;
+        sc.size = c->size;
+        sc.consumedSize = c->consumedSize;
+        sc.fileOffset = c->fileOffset;
+        sc.numSub = (uint)c->sub.size();
+        sc.selfBufSize = (uint)c->selfBuf.size();
+        recs.push_back(sc);
+        data += c->selfBuf;
+        for(const auto& s: c->sub)
+            rec(s);
+    };
+    rec(root);
+    w.array(recs);
+    w.str(data);
+}
+
+static shared_ptr<Chunk> readChunks(SnapReader& r, vector<shared_ptr<Chunk>>* chunks)
+{
+    vector<SnapChunk> recs;
+    r.array(&recs);
+    size_t dataSize = (size_t)r.count(1);
+    const char* data = r.take(dataSize);
+    CHECK(!recs.empty(), "Snapshot without a root chunk");
+
+    size_t dataPos = 0;
+    vector<pair<Chunk*, uint>> open; // chunks that still expect children, with how many are left
+    chunks->clear();
+    chunks->reserve(recs.size());
+    for(const auto& sc: recs) {
+        while (!open.empty() && open.back().second == 0)
+            open.pop_back();
+        CHECK(chunks->empty() || !open.empty(), "Bad chunk tree in snapshot");
+        Chunk* parent = open.empty() ? nullptr : open.back().first;
+        shared_ptr<Chunk> c(new Chunk(sc.id, sc.origSize, parent));
+        c->size = sc.size;
+        c->consumedSize = sc.consumedSize;
+        c->fileOffset = sc.fileOffset;
+        c->dirty = sc.dirty != 0;
+        CHECK(dataPos + sc.selfBufSize <= dataSize, "Bad chunk data in snapshot");
+        c->selfBuf.assign(data + dataPos, sc.selfBufSize);
+        dataPos += sc.selfBufSize;
+        if (parent != nullptr) {
+            parent->sub.push_back(c);
+            --open.back().second;
+        }
+        open.push_back(make_pair(c.get(), sc.numSub));
+        chunks->push_back(c);
+    }
+    return chunks->front();
+}
+
+static void writeGeom(SnapWriter& w, const SubMesh& g, const ChunkIndices& indices)
+{
+    SnapGeom sg = {};
+    sg.vertexSize = g.m_vertexSize;
+    sg.vertexCount = g.m_vertexCount;
+    sg.vertexBind = g.m_vertexBind;
+    sg.hasEntries = g.m_hasEntries;
+    sg.texCoordCount = g.m_texCoordCount;
+    sg.indicesCount = g.m_indicesCount;
+    sg.hasVtxAnimation = g.m_hasVtxAnimation;
+    sg.hasEdges = g.m_hasEdges;
+    sg.indices32bit = g.m_indices32bit;
+    sg.isSharedGeom = g.m_isSharedGeom;
+    sg.chunk = chunkIndex(indices, g.m_chunk);
+    sg.numBinds = (uint)g.m_entries.size();
+    w.pod(sg);
+    w.str(g.m_material);
+
+    for(const auto& bind: g.m_entries) {
+        SnapBind sb = { bind.entriesSize, chunkIndex(indices, bind.bufferChunk), (uint)bind.e.size() };
+        w.pod(sb);
+        for(const auto& e: bind.e) {
+            SnapEntry se = {};
+            se.source = e.source;
+            se.offset = e.offset;
+            se.type = e.type;
+            se.sem = e.sem;
+            se.index = e.index;
+            se.entryChunk = chunkIndex(indices, e.entryChunk);
+            w.pod(se);
+        }
+    }
+
+    // the raw data of every buffer, all the vertices of a buffer together. the fields are decoded from it
+    // again when loading, as in parsing
+    for(size_t b = 0; b < g.m_entries.size(); ++b) {
+        size_t vertexSize = g.m_entries[b].entriesSize;
+        CHECK(g.m_vtx.size() == (size_t)g.m_vertexCount, "Vertex count does not match vertices");
+        w.pod((uint64_t)(vertexSize * g.m_vtx.size()));
+        for(const auto& v: g.m_vtx) {
+            CHECK(b < v.selfBufs.size() && v.selfBufs[b].size() == vertexSize, "Vertex data does not match the declaration");
+            w.raw(v.selfBufs[b]);
+        }
+    }
+
+    w.array(g.m_indices);
+    w.array(g.m_boneAssign);
+}
+
+static void readGeom(SnapReader& r, SubMesh& g, const vector<shared_ptr<Chunk>>& chunks)
+{
+    SnapGeom sg = r.pod<SnapGeom>();
+    g.m_vertexSize = sg.vertexSize;
+    g.m_vertexCount = sg.vertexCount;
+    g.m_vertexBind = sg.vertexBind;
+    g.m_hasEntries = sg.hasEntries;
+    g.m_texCoordCount = sg.texCoordCount;
+    g.m_indicesCount = sg.indicesCount;
+    g.m_hasVtxAnimation = sg.hasVtxAnimation != 0;
+    g.m_hasEdges = sg.hasEdges != 0;
+    g.m_indices32bit = sg.indices32bit != 0;
+    g.m_isSharedGeom = sg.isSharedGeom != 0;
+    g.m_chunk = chunkAt(chunks, sg.chunk);
+    g.m_material = r.str();
+
+    CHECK(sg.numBinds <= 0xffff, "Bad buffer count in snapshot");
+    g.m_entries.resize(sg.numBinds);
+    for(auto& bind: g.m_entries) {
+        SnapBind sb = r.pod<SnapBind>();
+        bind.entriesSize = sb.entriesSize;
+        bind.bufferChunk = chunkAt(chunks, sb.bufferChunk);
+        CHECK(sb.numEntries <= 0xffff, "Bad entry count in snapshot");
+        for(uint i = 0; i < sb.numEntries; ++i) {
+            SnapEntry se = r.pod<SnapEntry>();
+            bind.e.push_back(VtxEntry{se.source, se.offset, se.type, semanticName(se.sem), se.sem, se.index, chunkAt(chunks, se.entryChunk)});
+        }
+    }
+
+    CHECK(g.m_vertexCount >= 0, "Bad vertex count in snapshot");
+    g.m_vtx.resize(g.m_vertexCount);
+    for(size_t b = 0; b < g.m_entries.size(); ++b) {
+        size_t size = (size_t)r.count(1);
+        g.decodeVertexBuffer(r.take(size), size, (int)b);
+    }
+
+    r.array(&g.m_indices);
+    r.array(&g.m_boneAssign);
+}
+
+void Mesh::saveSnapshot(string* outbuf)
+{
+    ScopedPhase phase("saveSnapshot");
+    CHECK(m_rootChunk, "Nothing to snapshot");
+    outbuf->clear();
+    SnapWriter w(*outbuf);
+    SnapHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.layoutSize = snapLayoutSize();
+    w.pod(header);
+
+    w.pod(m_fileVer);
+    w.str(m_headerBuf);
+    vector<ushort> passThrough(m_passThroughIds.begin(), m_passThroughIds.end());
+    w.array(passThrough);
+
+    ChunkIndices indices;
+    writeChunks(w, m_rootChunk, &indices);
+
+    w.pod((ubyte)(m_sharedGeom ? 1 : 0));
+    if (m_sharedGeom)
+        writeGeom(w, *m_sharedGeom, indices);
+    w.pod((uint64_t)m_sub.size());
+    for(const auto& sub: m_sub)
+        writeGeom(w, sub, indices);
+
+    w.pod((uint64_t)m_morphKeys.size());
+    for(const auto& key: m_morphKeys) {
+        SnapMorphKey sk = {};
+        sk.target = key.target;
+        sk.time = key.time;
+        sk.hasNormals = key.hasNormals;
+        sk.chunk = chunkIndex(indices, key.chunk);
+        w.pod(sk);
+        w.array(key.data);
+    }
+
+    w.pod((uint64_t)m_poses.size());
+    for(const auto& pose: m_poses) {
+        w.pod(pose.target);
+        w.pod((ubyte)pose.hasNormals);
+        vector<SnapPoseVertex> vtx(pose.vtx.size());
+        for(size_t i = 0; i < vtx.size(); ++i) {
+            const auto& pv = pose.vtx[i];
+            vtx[i] = SnapPoseVertex{pv.vertexIndex, pv.offset, pv.normal, chunkIndex(indices, pv.chunk)};
+        }
+        w.array(vtx);
+    }
+
+    w.pod((uint64_t)m_edgeLists.size());
+    for(const auto& el: m_edgeLists) {
+        SnapEdgeList sl = {};
+        sl.lodIndex = el.lodIndex;
+        sl.isManual = el.isManual;
+        sl.isClosed = el.isClosed;
+        sl.chunk = chunkIndex(indices, el.chunk);
+        sl.numGroups = (uint)el.groups.size();
+        w.pod(sl);
+        w.array(el.tris);
+        for(const auto& g: el.groups) {
+            w.pod(SnapEdgeGroup{g.vertexSet, g.triStart, g.triCount});
+            vector<SnapEdge> edges(g.edges.size());
+            for(size_t i = 0; i < edges.size(); ++i) {
+                const auto& e = g.edges[i];
+                auto& se = edges[i];
+                memset(&se, 0, sizeof(se));
+                memcpy(se.triIndex, e.triIndex, sizeof(se.triIndex));
+                memcpy(se.vertIndex, e.vertIndex, sizeof(se.vertIndex));
+                memcpy(se.sharedVertIndex, e.sharedVertIndex, sizeof(se.sharedVertIndex));
+                se.degenerate = e.degenerate;
+            }
+            w.array(edges);
+        }
+    }
+    phase.setBytes(outbuf->size());
+}
+
+void Mesh::saveSnapshot(const string& filename)
+{
+    string buf;
+    saveSnapshot(&buf);
+    ofstream outf(filename, ios::binary);
+    CHECK(outf.good(), "Failed opening file `" << filename << "`");
+    outf.write(buf.data(), buf.size());
+    CHECK(outf.good(), "Failed writing snapshot");
+}
+
+bool Mesh::isSnapshot(const char* data, size_t size)
+{
+    return size >= SNAPSHOT_MAGIC_SIZE && memcmp(data, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) == 0;
+}
+
+void Mesh::loadSnapshot(const char* data, size_t size)
+{
+    clear();
+    ScopedPhase phase("loadSnapshot", size);
+    SnapReader r(data, size);
+    SnapHeader header = r.pod<SnapHeader>();
+    CHECK(isSnapshot(header.magic, SNAPSHOT_MAGIC_SIZE), "Not a snapshot");
+    CHECK(header.version == SNAPSHOT_VERSION, "Unsupported snapshot version " << header.version);
+    CHECK(header.byteOrder == SNAPSHOT_BYTE_ORDER && header.layoutSize == snapLayoutSize(), "Snapshot made by a different build of the tool");
+
+    r.pod(&m_fileVer);
+    m_headerBuf = r.str();
+    vector<ushort> passThrough;
+    r.array(&passThrough);
+    m_passThroughIds.insert(passThrough.begin(), passThrough.end());
+
+    vector<shared_ptr<Chunk>> chunks;
+    m_rootChunk = readChunks(r, &chunks);
+
+    if (r.pod<ubyte>() != 0) {
+        m_sharedGeom.reset(new SubMesh);
+        readGeom(r, *m_sharedGeom, chunks);
+    }
+    uint64_t numSub = r.count(sizeof(SnapGeom));
+    m_sub.resize((size_t)numSub);
+    for(auto& sub: m_sub) {
+        readGeom(r, sub, chunks);
+        m_materials.insert(sub.m_material);
+        CHECK(!sub.m_isSharedGeom || m_sharedGeom, "SharedVtx submesh needs to have shared geom");
+    }
+    m_cursub = m_sub.empty() ? m_sharedGeom.get() : &m_sub.back();
+
+    uint64_t numKeys = r.count(sizeof(SnapMorphKey));
+    m_morphKeys.resize((size_t)numKeys);
+    for(auto& key: m_morphKeys) {
+        SnapMorphKey sk = r.pod<SnapMorphKey>();
+        key.target = sk.target;
+        key.time = sk.time;
+        key.hasNormals = sk.hasNormals != 0;
+        key.chunk = chunkAt(chunks, sk.chunk);
+        r.array(&key.data);
+    }
+
+    uint64_t numPoses = r.count(sizeof(int));
+    m_poses.resize((size_t)numPoses);
+    for(auto& pose: m_poses) {
+        r.pod(&pose.target);
+        pose.hasNormals = r.pod<ubyte>() != 0;
+        vector<SnapPoseVertex> vtx;
+        r.array(&vtx);
+        pose.vtx.resize(vtx.size());
+        for(size_t i = 0; i < vtx.size(); ++i) {
+            auto& pv = pose.vtx[i];
+            pv.vertexIndex = vtx[i].vertexIndex;
+            pv.offset = vtx[i].offset;
+            pv.normal = vtx[i].normal;
+            pv.chunk = chunkAt(chunks, vtx[i].chunk);
+        }
+    }
+
+    uint64_t numEdgeLists = r.count(sizeof(SnapEdgeList));
+    m_edgeLists.resize((size_t)numEdgeLists);
+    for(auto& el: m_edgeLists) {
+        SnapEdgeList sl = r.pod<SnapEdgeList>();
+        el.lodIndex = sl.lodIndex;
+        el.isManual = sl.isManual != 0;
+        el.isClosed = sl.isClosed != 0;
+        el.chunk = chunkAt(chunks, sl.chunk);
+        r.array(&el.tris);
+        CHECK(sl.numGroups <= 0xffffff, "Bad edge group count in snapshot");
+        el.groups.resize(sl.numGroups);
+        for(auto& g: el.groups) {
+            SnapEdgeGroup sg = r.pod<SnapEdgeGroup>();
+            g.vertexSet = sg.vertexSet;
+            g.triStart = sg.triStart;
+            g.triCount = sg.triCount;
+            vector<SnapEdge> edges;
+            r.array(&edges);
+            g.edges.resize(edges.size());
+            for(size_t i = 0; i < edges.size(); ++i) {
+                auto& e = g.edges[i];
+                memcpy(e.triIndex, edges[i].triIndex, sizeof(e.triIndex));
+                memcpy(e.vertIndex, edges[i].vertIndex, sizeof(e.vertIndex));
+                memcpy(e.sharedVertIndex, edges[i].sharedVertIndex, sizeof(e.sharedVertIndex));
+                e.degenerate = edges[i].degenerate != 0;
+            }
+        }
+    }
+    CHECK(r.eof(), "Unexpected data at the end of the snapshot");
+}
@@ -0,0 +1,211 @@
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <cstdint>
+#include "ObjReader.h"
+#include "FileView.h"
+
+// powers of 10 that are exact in a double
+static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+static inline void skipSpace(const char*& p, const char* end) {
+    while (p < end && isSpace(*p))
+        ++p;
+}
+
+// numbers that are not simple decimals (inf, nan, too many digits) go through strtof
+static float slowParseFloat(const char* start, const char*& p, const char* end)
+{
+    p = start;
+    while (p < end && !isSpace(*p) && *p != '\n')
+        ++p;
+    string token(start, p);
+    char* tokenEnd = nullptr;
+    float v = strtof(token.c_str(), &tokenEnd);
+    CHECK(tokenEnd != token.c_str() && *tokenEnd == '\0', "Bad number `" << token << "` in obj");
+    return v;
+}
+
+// the digits are collected to an integer and scaled by an exact power of 10, a single correctly rounded
+// operation in double. that is then rounded to float, which is only wrong when the double is exactly
+// halfway between two floats
+float parseFloat(const char*& p, const char* end)
+{
+    const char* start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        ++p;
+    }
+    uint64_t m = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false, truncated = false;
+    for(; p < end && isDigit(*p); ++p) {
+        any = true;
+        if (digits < 19) {
+            m = m * 10 + (*p - '0');
+            if (m != 0)
+                ++digits;
+        }
+        else {
+            ++exp10;
+            truncated |= (*p != '0');
+        }
+    }
+    if (p < end && *p == '.') {
+        for(++p; p < end && isDigit(*p); ++p) {
+            any = true;
+            if (digits < 19) {
+                m = m * 10 + (*p - '0');
+                if (m != 0)
+                    ++digits;
+                --exp10;
+            }
+            else
+                truncated |= (*p != '0');
+        }
+    }
+    if (!any)
+        return slowParseFloat(start, p, end);
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool eneg = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            eneg = (*e == '-');
+            ++e;
+        }
+        if (e < end && isDigit(*e)) {
+            int ev = 0;
+            for(; e < end && isDigit(*e); ++e) {
+                if (ev < 10000)
+                    ev = ev * 10 + (*e - '0');
+            }
+            exp10 += eneg ? -ev : ev;
+            p = e;
+        }
+    }
+
+    if (!truncated && m <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        double r = (exp10 >= 0) ? (double)m * POW10[exp10] : (double)m / POW10[-exp10];
+        uint64_t bits;
+        memcpy(&bits, &r, sizeof(bits));
+        if (r == 0.0 || (r >= FLT_MIN && r <= FLT_MAX && (bits & 0x1fffffff) != 0x10000000)) {
+            float v = (float)r;
+            return neg ? -v : v;
+        }
+    }
+    return slowParseFloat(start, p, end);
+}
+
+// from 1 or negative from the end to 0 based
+static int parseIndex(const char*& p, const char* end, size_t count, int line)
+{
+    bool neg = false;
+    if (p < end && *p == '-') {
+        neg = true;
+        ++p;
+    }
+    CHECK(p < end && isDigit(*p), "Expected an index in obj line " << line);
+    long long v = 0;
+    for(; p < end && isDigit(*p); ++p) {
+        if (v <= (long long)count)
+            v = v * 10 + (*p - '0');
+    }
+    long long index = neg ? (long long)count - v : v - 1;
+    CHECK(v != 0 && index >= 0 && index < (long long)count, "Index out of range in obj line " << line);
+    return (int)index;
+}
+
+static void readFloats(const char*& p, const char* end, float* out, int count)
+{
+    for(int i = 0; i < count; ++i) {
+        skipSpace(p, end);
+        out[i] = parseFloat(p, end);
+    }
+}
+
+void readObj(const char* data, size_t size, ObjData& obj)
+{
+    obj.clear();
+    const char* end = data + size;
+    const char* p = data;
+    vector<ObjCorner> poly;
+    int line = 0;
+    while (p < end) {
+        ++line;
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (lineEnd == nullptr)
+            lineEnd = end;
+        skipSpace(p, lineEnd);
+
+        if (lineEnd - p > 1 && p[0] == 'v' && isSpace(p[1])) {
+            Vec3 v;
+            p += 2;
+            readFloats(p, lineEnd, &v.x, 3);
+            obj.pos.push_back(v);
+        }
+        else if (lineEnd - p > 2 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+            Vec2 v;
+            p += 3;
+            readFloats(p, lineEnd, &v.x, 2);
+            obj.tex.push_back(v);
+        }
+        else if (lineEnd - p > 2 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+            Vec3 v;
+            p += 3;
+            readFloats(p, lineEnd, &v.x, 3);
+            obj.normal.push_back(v);
+        }
+        else if (lineEnd - p > 1 && p[0] == 'f' && isSpace(p[1])) {
+            poly.clear();
+            p += 2;
+            skipSpace(p, lineEnd);
+            while (p < lineEnd) {
+                ObjCorner c = { parseIndex(p, lineEnd, obj.pos.size(), line), -1, -1 };
+                if (p < lineEnd && *p == '/') {
+                    ++p;
+                    if (p < lineEnd && *p != '/')
+                        c.vt = parseIndex(p, lineEnd, obj.tex.size(), line);
+                    if (p < lineEnd && *p == '/') {
+                        ++p;
+                        c.vn = parseIndex(p, lineEnd, obj.normal.size(), line);
+                    }
+                }
+                CHECK(p == lineEnd || isSpace(*p), "Bad face in obj line " << line);
+                poly.push_back(c);
+                skipSpace(p, lineEnd);
+            }
+            CHECK(poly.size() >= 3, "Face with less than 3 vertices in obj line " << line);
+            // a fan around the first corner
+            for(size_t i = 2; i < poly.size(); ++i) {
+                obj.corners.push_back(poly[0]);
+                obj.corners.push_back(poly[i - 1]);
+                obj.corners.push_back(poly[i]);
+            }
+        }
+        else if (lineEnd - p > 6 && memcmp(p, "usemtl", 6) == 0 && isSpace(p[6])) {
+            p += 7;
+            skipSpace(p, lineEnd);
+            const char* nameEnd = lineEnd;
+            while (nameEnd > p && isSpace(nameEnd[-1]))
+                --nameEnd;
+            obj.materials.push_back({ obj.corners.size(), string(p, nameEnd) });
+        }
+        // comments, groups, material libraries, smoothing groups are not needed
+
+        p = lineEnd + 1;
+    }
+}
+
+void readObjFile(const string& filename, ObjData& obj)
+{
+    FileView file(filename);
+    readObj(file.data(), file.size(), obj);
+}
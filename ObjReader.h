@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Mesh.h"
+
+using namespace std;
+
+// the indices of one corner of a face, from 0. -1 when the face has no texture coordinate or normal
+struct ObjCorner {
+    int v;
+    int vt;
+    int vn;
+};
+
+// the material of the triangles from the corner start until the next range
+struct ObjMaterialRange {
+    size_t start;
+    string material;
+};
+
+struct ObjData {
+    vector<Vec3> pos;
+    vector<Vec2> tex;
+    vector<Vec3> normal;
+    vector<ObjCorner> corners; // 3 for every triangle, polygons are split to triangles
+    vector<ObjMaterialRange> materials; // from usemtl lines
+
+    void clear() {
+        pos.clear();
+        tex.clear();
+        normal.clear();
+        corners.clear();
+        materials.clear();
+    }
+};
+
+// reads the text of an OBJ file into obj. supports v, vt, vn and f with the v, v/vt, v//vn and v/vt/vn forms
+// and usemtl. negative indices count back from the last one read. other lines are ignored
+void readObj(const char* data, size_t size, ObjData& obj);
+// the file is mapped, not copied
+void readObjFile(const string& filename, ObjData& obj);
+
+// not affected by the locale. p is moved past the number
+float parseFloat(const char*& p, const char* end);
@@ -0,0 +1,277 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "ObjWriter.h"
+#include "ObjReader.h"
+
+#define OBJ_BLOCK_SIZE (1 << 20)
+
+// powers of 10 that are exact in a double
+static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+int formatUint(uint v, char* out)
+{
+    char tmp[12];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    for(int i = 0; i < n; ++i)
+        out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+// is the decimal, approximated by value, certain to be read as f. value can be off by a double rounding
+// or two, so it needs to be clearly inside the range of values that round to f
+static bool readsAs(double value, float f)
+{
+    if ((float)value != f)
+        return false;
+    double lowMid = ((double)f + (double)nextafterf(f, 0.0f)) / 2.0;
+    double highMid = ((double)f + (double)nextafterf(f, INFINITY)) / 2.0;
+    double margin = value * 1e-15;
+    return value - margin > lowMid && value + margin < highMid;
+}
+
+// digits of m, with the decimal point shifted by exp10
+static int formatDecimal(unsigned long long m, int exp10, char* out)
+{
+    while (m % 10 == 0) {
+        m /= 10;
+        ++exp10;
+    }
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + m % 10);
+        m /= 10;
+    } while (m != 0);
+    for(int i = 0; i < n / 2; ++i)
+        swap(digits[i], digits[n - 1 - i]);
+
+    char* p = out;
+    int pointPos = n + exp10; // digits before the decimal point
+    if (exp10 >= 0 && pointPos <= 15) { // integer
+        memcpy(p, digits, n);
+        p += n;
+        for(int i = 0; i < exp10; ++i)
+            *p++ = '0';
+    }
+    else if (pointPos > 0 && exp10 < 0) {
+        memcpy(p, digits, pointPos);
+        p += pointPos;
+        *p++ = '.';
+        memcpy(p, digits + pointPos, n - pointPos);
+        p += n - pointPos;
+    }
+    else if (pointPos <= 0 && pointPos > -5) {
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = 0; i < -pointPos; ++i)
+            *p++ = '0';
+        memcpy(p, digits, n);
+        p += n;
+    }
+    else {
+        *p++ = digits[0];
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, n - 1);
+            p += n - 1;
+        }
+        *p++ = 'e';
+        int e = pointPos - 1;
+        if (e < 0) {
+            *p++ = '-';
+            e = -e;
+        }
+        p += formatUint((uint)e, p);
+    }
+    return (int)(p - out);
+}
+
+// tries 1 to 9 significant digits, 9 always reads back as the same float
+int formatFloat(float v, char* out)
+{
+    if (std::isnan(v) || std::isinf(v))
+        return snprintf(out, 24, "%.9g", v);
+    char* p = out;
+    if (signbit(v)) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (v == 0.0f) {
+        *p++ = '0';
+        return (int)(p - out);
+    }
+    double d = v;
+    int e = (int)floor(log10(d)); // position of the first digit
+    for(int k = 1; k <= 9; ++k) {
+        int p10 = k - 1 - e;
+        if (p10 > 22 || p10 < -22)
+            break;
+        double scaled = (p10 >= 0) ? d * POW10[p10] : d / POW10[-p10];
+        double m = floor(scaled + 0.5);
+        double back = (p10 >= 0) ? m / POW10[p10] : m * POW10[-p10];
+        // whole numbers below 2^53 are exact, then the conversion rounds the same way as reading the text
+        bool exact = p10 <= 0 && back <= 9007199254740992.0;
+        if (m > 0.0 && (exact ? (float)back == v : readsAs(back, v)))
+            return (int)(p - out) + formatDecimal((unsigned long long)m, -p10, p);
+    }
+    // very large or very small values, rare in meshes
+    int len = 0;
+    for(int k = 1; k <= 9; ++k) {
+        len = snprintf(p, 24, "%.*g", k, v);
+        if (strtof(p, nullptr) == v)
+            break;
+    }
+    return (int)(p - out) + len;
+}
+
+
+ObjWriter::ObjWriter(ostream* out) : m_out(out)
+{
+    if (m_out != nullptr)
+        m_buf.reserve(OBJ_BLOCK_SIZE + 4096);
+}
+
+ObjWriter::~ObjWriter()
+{
+    if (m_out != nullptr && !m_buf.empty())
+        m_out->write(m_buf.data(), m_buf.size()); // can't throw from here
+}
+
+void ObjWriter::flush()
+{
+    if (m_out == nullptr)
+        return;
+    m_out->write(m_buf.data(), m_buf.size());
+    CHECK(m_out->good(), "Failed writing obj");
+    m_buf.clear();
+}
+
+void ObjWriter::checkFlush()
+{
+    if (m_out != nullptr && m_buf.size() >= OBJ_BLOCK_SIZE)
+        flush();
+}
+
+void ObjWriter::writeFloats(const char* cmd, const float* v, int count)
+{
+    char line[4 + 3 * 26];
+    char* p = line;
+    size_t cmdLen = strlen(cmd);
+    memcpy(p, cmd, cmdLen);
+    p += cmdLen;
+    for(int i = 0; i < count; ++i) {
+        *p++ = ' ';
+        p += formatFloat(v[i], p);
+    }
+    *p++ = '\n';
+    m_buf.append(line, p - line);
+}
+
+// texture coordinates and normals are counted on their own since geometries don't all have them
+void ObjWriter::writeGeometry(const SubMesh& geom, uint flags, ObjBase* base)
+{
+    base->v = m_vtxCount;
+    base->vt = m_texCount;
+    base->vn = m_normalCount;
+    for(const auto& vtx: geom.m_vtx) {
+        writeFloats("v", &vtx.pos.x, 3);
+        if (flags & VF_TEXCOORD0)
+            writeFloats("vt", &vtx.tex[0].x, 2);
+        if (flags & VF_NORMAL)
+            writeFloats("vn", &vtx.normal.x, 3);
+        checkFlush();
+    }
+    uint count = (uint)geom.m_vtx.size();
+    m_vtxCount += count;
+    if (flags & VF_TEXCOORD0)
+        m_texCount += count;
+    if (flags & VF_NORMAL)
+        m_normalCount += count;
+}
+
+// the position, texture coordinate and normal of a corner come from the same vertex, each from its own base
+void ObjWriter::writeIndex(uint i, const ObjBase& base, uint flags)
+{
+    char buf[40];
+    char* p = buf;
+    *p++ = ' ';
+    p += formatUint(base.v + i + 1, p);
+    if (flags & (VF_TEXCOORD0 | VF_NORMAL)) {
+        *p++ = '/';
+        if (flags & VF_TEXCOORD0)
+            p += formatUint(base.vt + i + 1, p);
+        if (flags & VF_NORMAL) {
+            *p++ = '/';
+            p += formatUint(base.vn + i + 1, p);
+        }
+    }
+    m_buf.append(buf, p - buf);
+}
+
+void ObjWriter::writeFaces(const SubMesh& sub, const ObjBase& base, uint flags)
+{
+    CHECK(sub.m_indices.size() % 3 == 0, "Only triangle lists can be written to obj");
+    for(size_t i = 0; i < sub.m_indices.size(); i += 3) {
+        m_buf += 'f';
+        for(int j = 0; j < 3; ++j)
+            writeIndex(sub.m_indices[i + j], base, flags);
+        m_buf += '\n';
+        checkFlush();
+    }
+}
+
+void ObjWriter::writeTriangle(const ObjCorner* corners, uint vBase, uint vtBase, uint vnBase)
+{
+    char buf[3 * 36 + 2];
+    char* p = buf;
+    *p++ = 'f';
+    for(int i = 0; i < 3; ++i) {
+        const ObjCorner& c = corners[i];
+        *p++ = ' ';
+        p += formatUint(vBase + c.v + 1, p);
+        if (c.vt >= 0 || c.vn >= 0) {
+            *p++ = '/';
+            if (c.vt >= 0)
+                p += formatUint(vtBase + c.vt + 1, p);
+            if (c.vn >= 0) {
+                *p++ = '/';
+                p += formatUint(vnBase + c.vn + 1, p);
+            }
+        }
+    }
+    *p++ = '\n';
+    m_buf.append(buf, p - buf);
+    checkFlush();
+}
+
+void ObjWriter::writeMesh(const Mesh& mesh)
+{
+    ObjBase sharedBase;
+    uint sharedFlags = 0;
+    if (mesh.m_sharedGeom.get() != nullptr) {
+        if (m_attributes)
+            sharedFlags = mesh.m_sharedGeom->m_hasEntries & (VF_NORMAL | VF_TEXCOORD0);
+        writeGeometry(*mesh.m_sharedGeom, sharedFlags, &sharedBase);
+    }
+
+    for(size_t i = 0; i < mesh.m_sub.size(); ++i) {
+        const auto& sub = mesh.m_sub[i];
+        ObjBase base = sharedBase;
+        uint flags = sharedFlags;
+        if (!sub.m_isSharedGeom) {
+            flags = m_attributes ? (sub.m_hasEntries & (VF_NORMAL | VF_TEXCOORD0)) : 0;
+            writeGeometry(sub, flags, &base);
+        }
+        if (m_attributes) {
+            m_buf += "g sub" + to_string(i) + "\n";
+            m_buf += "usemtl " + sub.m_material + "\n";
+        }
+        writeFaces(sub, base, flags);
+    }
+}
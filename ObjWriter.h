@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <iostream>
+#include "Mesh.h"
+
+using namespace std;
+
+struct ObjCorner;
+
+// formats a float with the fewest significant digits that read back as exactly the same float.
+// not affected by the locale. out needs room for 24 chars, returns the length written
+int formatFloat(float v, char* out);
+int formatUint(uint v, char* out);
+
+// writes meshes as OBJ text into a large buffer that is written to the output in big blocks
+class ObjWriter
+{
+public:
+    // with a null out everything stays in the buffer
+    ObjWriter(ostream* out = nullptr);
+    ~ObjWriter();
+
+    // normals, texture coordinates and a group with the material for every submesh. without them only positions and faces are written
+    void setAttributes(bool attributes) {
+        m_attributes = attributes;
+    }
+
+    // all the submeshes and the shared geometry. vertex indices continue from the meshes that were written
+    // before so several meshes can be written to one file
+    void writeMesh(const Mesh& mesh);
+
+    // single lines, for copying from other OBJ files
+    void writePosition(const Vec3& v) {
+        writeFloats("v", &v.x, 3);
+        checkFlush();
+    }
+    void writeTexCoord(const Vec2& v) {
+        writeFloats("vt", &v.x, 2);
+        checkFlush();
+    }
+    void writeNormal(const Vec3& v) {
+        writeFloats("vn", &v.x, 3);
+        checkFlush();
+    }
+    // the indices of the corners are offset by the number of positions, texture coordinates and normals before them
+    void writeTriangle(const ObjCorner* corners, uint vBase, uint vtBase, uint vnBase);
+
+    void flush();
+    const string& buffer() const {
+        return m_buf;
+    }
+    string takeBuffer() {
+        string s;
+        s.swap(m_buf);
+        return s;
+    }
+    // vertices written so far, the next vertex index is this + 1
+    uint vertexCount() const {
+        return m_vtxCount;
+    }
+    // when the text is appended after other text with that many vertices, and no texture coordinates or normals
+    void setVertexCount(uint count) {
+        m_vtxCount = count;
+    }
+
+private:
+    // index before the first vertex of a geometry of each kind of line
+    struct ObjBase {
+        uint v = 0, vt = 0, vn = 0;
+    };
+    void writeGeometry(const SubMesh& geom, uint flags, ObjBase* base);
+    void writeFaces(const SubMesh& sub, const ObjBase& base, uint flags);
+    void writeFloats(const char* cmd, const float* v, int count);
+    void writeIndex(uint i, const ObjBase& base, uint flags);
+    void checkFlush();
+
+    ostream* m_out;
+    string m_buf;
+    bool m_attributes = true;
+    uint m_vtxCount = 0;
+    uint m_texCount = 0;    // vt lines written so far
+    uint m_normalCount = 0; // vn lines written so far
+};
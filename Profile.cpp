@@ -0,0 +1,221 @@
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+#include <new>
+#include "Profile.h"
+
+static ProfileOutput g_defaultOutput;
+static thread_local ProfileOutput* t_output = nullptr;
+
+struct FileProfile {
+    bool active = false;
+    string name;
+    map<string, PhaseStats> phases;
+};
+static thread_local FileProfile t_file;
+
+static thread_local uint64_t t_allocs = 0;
+static thread_local uint64_t t_allocBytes = 0;
+
+#ifdef MESH_TOOL
+// allocations are counted only in the command line tools. the library should not replace the allocator of the host.
+// all the forms of new and delete are replaced so that every allocation is counted and freed the same way
+static void* countedAlloc(size_t size) noexcept {
+    ++t_allocs;
+    t_allocBytes += size;
+    return malloc(size ? size : 1);
+}
+// not inlined into the delete operators, gcc would see free() of memory from operator new and warn
+#if defined(__GNUC__)
+__attribute__((noinline))
+#elif defined(_MSC_VER)
+__declspec(noinline)
+#endif
+static void countedFree(void* p) noexcept {
+    free(p);
+}
+
+void* operator new(size_t size) {
+    void* p = countedAlloc(size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {
+    void* p = countedAlloc(size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+void operator delete(void* p) noexcept {
+    countedFree(p);
+}
+void operator delete[](void* p) noexcept {
+    countedFree(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    countedFree(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    countedFree(p);
+}
+void operator delete(void* p, const nothrow_t&) noexcept {
+    countedFree(p);
+}
+void operator delete[](void* p, const nothrow_t&) noexcept {
+    countedFree(p);
+}
+#endif
+
+void PhaseStats::add(const PhaseStats& o) {
+    ms += o.ms;
+    bytes += o.bytes;
+    calls += o.calls;
+    allocs += o.allocs;
+    allocBytes += o.allocBytes;
+}
+
+static double nowMs() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void writeJsonStr(ostream& out, const string& s)
+{
+    out << '"';
+    for(char c: s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+            out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void writePhases(ostream& out, const map<string, PhaseStats>& phases)
+{
+    out << "\"phases\":{";
+    bool first = true;
+    for(const auto& p: phases) {
+        if (!first)
+            out << ",";
+        first = false;
+        writeJsonStr(out, p.first);
+        const auto& st = p.second;
+        out << ":{\"ms\":" << st.ms << ",\"bytes\":" << st.bytes << ",\"calls\":" << st.calls
+            << ",\"allocs\":" << st.allocs << ",\"allocBytes\":" << st.allocBytes << "}";
+    }
+    out << "}";
+}
+
+void ProfileOutput::writeFile(const string& name, const map<string, PhaseStats>& phases)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_out == nullptr)
+        return;
+    ++m_totalFiles;
+    for(const auto& p: phases)
+        m_totals[p.first].add(p.second);
+    *m_out << "{\"file\":";
+    writeJsonStr(*m_out, name);
+    *m_out << ",";
+    writePhases(*m_out, phases);
+    *m_out << "}" << endl;
+}
+
+void ProfileOutput::addTotal(const string& phase, const PhaseStats& stats)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_totals[phase].add(stats);
+}
+
+void ProfileOutput::writeTotals()
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_out == nullptr)
+        return;
+    *m_out << "{\"totalFiles\":" << m_totalFiles << ",";
+    writePhases(*m_out, m_totals);
+    *m_out << "}" << endl;
+}
+
+void Profile::setOutput(ostream* out) {
+    g_defaultOutput.setStream(out);
+}
+
+void Profile::setThreadOutput(ProfileOutput* out) {
+    t_output = out;
+}
+
+ProfileOutput* Profile::output() {
+    return t_output ? t_output : &g_defaultOutput;
+}
+
+void Profile::beginFile(const string& name)
+{
+    if (!enabled())
+        return;
+    t_file.active = true;
+    t_file.name = name;
+    t_file.phases.clear();
+}
+
+void Profile::endFile()
+{
+    if (!enabled() || !t_file.active)
+        return;
+    t_file.active = false;
+    output()->writeFile(t_file.name, t_file.phases);
+}
+
+void Profile::writeTotals()
+{
+    g_defaultOutput.writeTotals();
+}
+
+void Profile::addPhase(const string& phase, const PhaseStats& stats)
+{
+    if (t_file.active) {
+        t_file.phases[phase].add(stats);
+        return;
+    }
+    // not part of any file, only in the totals
+    output()->addTotal(phase, stats);
+}
+
+void Profile::allocCounts(uint64_t* allocs, uint64_t* allocBytes)
+{
+    *allocs = t_allocs;
+    *allocBytes = t_allocBytes;
+}
+
+
+ScopedPhase::ScopedPhase(const char* phase, uint64_t bytes)
+    : m_phase(phase), m_enabled(Profile::enabled())
+{
+    if (!m_enabled)
+        return;
+    m_stats.bytes = bytes;
+    Profile::allocCounts(&m_stats.allocs, &m_stats.allocBytes);
+    m_start = nowMs();
+}
+
+ScopedPhase::~ScopedPhase()
+{
+    if (!m_enabled)
+        return;
+    m_stats.ms = nowMs() - m_start;
+    m_stats.calls = 1;
+    uint64_t allocs = 0, allocBytes = 0;
+    Profile::allocCounts(&allocs, &allocBytes);
+    m_stats.allocs = allocs - m_stats.allocs;
+    m_stats.allocBytes = allocBytes - m_stats.allocBytes;
+    Profile::addPhase(m_phase, m_stats);
+}
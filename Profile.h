@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <iostream>
+#include <cstdint>
+#include <mutex>
+
+using namespace std;
+
+// per phase wall time, bytes processed and allocations. phases may nest, an inner phase is also counted in the outer one
+struct PhaseStats {
+    double ms = 0.0;
+    uint64_t bytes = 0;
+    uint64_t calls = 0;
+    uint64_t allocs = 0;     // only counted in MESH_TOOL builds
+    uint64_t allocBytes = 0;
+
+    void add(const PhaseStats& o);
+};
+
+// a stream the files are written to and the totals of those files. the stream is written from several threads under a lock
+class ProfileOutput
+{
+public:
+    // null disables profiling
+    void setStream(ostream* out) {
+        m_out = out;
+    }
+    ostream* stream() const {
+        return m_out;
+    }
+
+    void writeFile(const string& name, const map<string, PhaseStats>& phases);
+    void addTotal(const string& phase, const PhaseStats& stats);
+    void writeTotals();
+
+private:
+    ostream* m_out = nullptr;
+    mutex m_mutex; // guards the totals and the stream
+    map<string, PhaseStats> m_totals;
+    int m_totalFiles = 0;
+};
+
+// collects the phases of the file that is being processed on this thread. when a file is done
+// its phases are written as a JSON line and added to the totals of all the files
+class Profile
+{
+public:
+    // the default output. null disables profiling, which is the default
+    static void setOutput(ostream* out);
+    // an output used instead of the default one on this thread, so that a library user doesn't change the
+    // output of the host. null goes back to the default
+    static void setThreadOutput(ProfileOutput* out);
+    static bool enabled() {
+        return output()->stream() != nullptr;
+    }
+
+    static void beginFile(const string& name);
+    static void endFile();
+    // one JSON line with the totals of all the files so far, of the default output
+    static void writeTotals();
+
+    static void addPhase(const string& phase, const PhaseStats& stats);
+    static void allocCounts(uint64_t* allocs, uint64_t* allocBytes);
+
+private:
+    static ProfileOutput* output();
+};
+
+// measures the scope it's in as a phase of the current file
+class ScopedPhase
+{
+public:
+    ScopedPhase(const char* phase, uint64_t bytes = 0);
+    ~ScopedPhase();
+    // when the size is known only at the end of the phase
+    void setBytes(uint64_t bytes) {
+        m_stats.bytes = bytes;
+    }
+
+private:
+    const char* m_phase;
+    bool m_enabled;
+    double m_start = 0.0;
+    PhaseStats m_stats;
+};
+
+// the output of the files processed on this thread while in scope
+class ScopedProfileOutput
+{
+public:
+    ScopedProfileOutput(ProfileOutput* out) {
+        Profile::setThreadOutput(out);
+    }
+    ~ScopedProfileOutput() {
+        Profile::setThreadOutput(nullptr);
+    }
+};
+
+// a file that is processed between the construction and the destruction
+class ScopedProfileFile
+{
+public:
+    ScopedProfileFile(const string& name) {
+        Profile::beginFile(name);
+    }
+    ~ScopedProfileFile() {
+        Profile::endFile();
+    }
+};
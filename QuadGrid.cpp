@@ -1,4 +1,5 @@
 #include "QuadGrid.h"
+#include "Profile.h"
 
 
 
@@ -200,8 +201,9 @@ void QuadGrid::reinit() {
 }
 
 
-void QuadGrid::solve()
+void QuadGrid::solve(ostream& out)
 {
+    ScopedPhase phase("quadSolve", m_data.size() * sizeof(Cell));
     //Grid initial, best;
     srand(0);
 
@@ -231,7 +233,7 @@ void QuadGrid::solve()
     }
 
     m_squares = bestSquares;
-    cout << "QuadGrid " << m_ylevel << " found " << m_squares.size() << " squares pass=" << minPass << endl;
+    out << "QuadGrid " << m_ylevel << " found " << m_squares.size() << " squares pass=" << minPass << endl;
 
 
 }
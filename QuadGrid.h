@@ -72,7 +72,7 @@ public:
     void initMarks();
     Square candidate(int c);
     void reinit();
-    void solve();
+    void solve(ostream& out);
 
     vector<Square> m_squares;
 
@@ -0,0 +1,199 @@
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "ResultCache.h"
+#include "Except.h"
+
+#ifdef _WIN32
+  #include <direct.h>
+  #define mkdir(path, mode) _mkdir(path)
+#else
+  #include <sys/stat.h>
+#endif
+
+// bump when a change to the processing changes the output, so old entries are not used
+#define CACHE_VERSION 2
+#define CACHE_MAGIC 0x4341474f // "OGAC"
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t xxround(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+static inline uint64_t xxmerge(uint64_t acc, uint64_t val) {
+    acc ^= xxround(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t xxhash64(const void* data, size_t len, uint64_t seed)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxround(v1, read64(p));
+            v2 = xxround(v2, read64(p + 8));
+            v3 = xxround(v3, read64(p + 16));
+            v4 = xxround(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxmerge(h, v1);
+        h = xxmerge(h, v2);
+        h = xxmerge(h, v3);
+        h = xxmerge(h, v4);
+    }
+    else {
+        h = seed + PRIME5;
+    }
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= xxround(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+bool readFile(const string& filename, string* data)
+{
+    ifstream inf(filename, ios::binary);
+    if (!inf.good())
+        return false;
+    inf.seekg(0, ios_base::end);
+    data->resize((size_t)inf.tellg());
+    inf.seekg(0);
+    inf.read((char*)data->data(), data->size());
+    return inf.good();
+}
+
+void writeFile(const string& filename, const string& data)
+{
+    ofstream outf(filename, ios::binary);
+    CHECK(outf.good(), "Failed opening file `" << filename << "`");
+    outf.write(data.data(), data.size());
+    CHECK(outf.good(), "Failed writing file `" << filename << "`");
+}
+
+
+ResultCache::ResultCache(const string& dir) : m_hits(0), m_misses(0), m_dir(dir)
+{
+    if (!m_dir.empty())
+        mkdir(m_dir.c_str(), 0755); // fails harmlessly if it already exists
+}
+
+string ResultCache::makeKey(const string& inputData, const string& params) const
+{
+    uint64_t paramsHash = xxhash64(params.data(), params.size(), CACHE_VERSION);
+    uint64_t h = xxhash64(inputData.data(), inputData.size(), paramsHash);
+    // the size in the key makes a collision even less likely
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%016llx_%llu", (unsigned long long)h, (unsigned long long)inputData.size());
+    return buf;
+}
+
+string ResultCache::entryPath(const string& key) const {
+    return m_dir + "/" + key + ".cache";
+}
+
+// an entry is a small header with the stats followed by the result data
+bool ResultCache::get(const string& key, string* data, vector<int>* stats)
+{
+    string buf;
+    if (!enabled() || !readFile(entryPath(key), &buf)) {
+        ++m_misses;
+        return false;
+    }
+    uint32_t header[3];
+    if (buf.size() < sizeof(header)) {
+        ++m_misses;
+        return false;
+    }
+    memcpy(header, buf.data(), sizeof(header));
+    size_t statsSize = header[2] * sizeof(int);
+    if (header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION || buf.size() < sizeof(header) + statsSize) {
+        ++m_misses; // written by a different version or truncated
+        return false;
+    }
+    if (stats != nullptr) {
+        stats->resize(header[2]);
+        memcpy(stats->data(), buf.data() + sizeof(header), statsSize);
+    }
+    data->assign(buf, sizeof(header) + statsSize, string::npos);
+    ++m_hits;
+    return true;
+}
+
+void ResultCache::put(const string& key, const string& data, const vector<int>& stats)
+{
+    if (!enabled())
+        return;
+    uint32_t header[3] = { CACHE_MAGIC, CACHE_VERSION, (uint32_t)stats.size() };
+    string buf;
+    buf.reserve(sizeof(header) + stats.size() * sizeof(int) + data.size());
+    buf.append((const char*)header, sizeof(header));
+    buf.append((const char*)stats.data(), stats.size() * sizeof(int));
+    buf += data;
+
+    // write to a temporary file and rename so that an interrupted run does not leave a partial entry
+    string path = entryPath(key);
+    // unique per thread so that jobs running in parallel on the same input don't write the same file
+    string tmpPath = path + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+    writeFile(tmpPath, buf);
+#ifdef _WIN32
+    remove(path.c_str()); // rename doesn't replace an existing file. on posix it does, atomically for readers
+#endif
+    CHECK(rename(tmpPath.c_str(), path.c_str()) == 0, "Failed renaming cache entry `" << path << "`");
+}
+
+void ResultCache::printStats(ostream& out)
+{
+    if (!enabled())
+        return;
+    out << "Cache hits=" << m_hits << " misses=" << m_misses << endl;
+}
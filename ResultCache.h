@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <atomic>
+
+using namespace std;
+
+// xxHash64 of a buffer
+uint64_t xxhash64(const void* data, size_t len, uint64_t seed = 0);
+
+bool readFile(const string& filename, string* data);
+void writeFile(const string& filename, const string& data);
+
+// on-disk cache of processing results. the key is a hash of the input file content together with
+// a description of the processing done to it, so a file that did not change is not processed again
+class ResultCache
+{
+public:
+    // an empty dir disables the cache
+    ResultCache(const string& dir);
+
+    bool enabled() const {
+        return !m_dir.empty();
+    }
+    // params should describe everything that affects the result: procs, epsilon, actions
+    string makeKey(const string& inputData, const string& params) const;
+
+    // stats are a few numbers about the result that are needed without parsing it
+    bool get(const string& key, string* data, vector<int>* stats = nullptr);
+    void put(const string& key, const string& data, const vector<int>& stats = vector<int>());
+
+    void printStats(ostream& out);
+
+    // get and put can be called from several threads
+    atomic<int> m_hits;
+    atomic<int> m_misses;
+
+private:
+    string entryPath(const string& key) const;
+
+    string m_dir;
+};
@@ -0,0 +1,226 @@
+#include <sstream>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include "Server.h"
+#include "WorkQueue.h"
+#include "Except.h"
+
+#ifdef _WIN32
+
+int serve(const string& socketPath, int numThreads, const JobFunc& runJob)
+{
+    cerr << "Server mode is not supported on windows" << endl;
+    return 1;
+}
+
+#else // posix
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+
+// a client connection. closed when the reader and all the jobs it queued are done with it
+struct Connection
+{
+    Connection(int _fd) : fd(_fd) {}
+    ~Connection() {
+        close(fd);
+    }
+    // responses of jobs that finish at the same time must not be interleaved
+    void send(const string& data) {
+        lock_guard<mutex> lock(writeMutex);
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t w = write(fd, p, left);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return; // the client went away, nothing to do with the response
+            p += w;
+            left -= (size_t)w;
+        }
+    }
+
+    int fd;
+    mutex writeMutex;
+};
+
+// shared by the accept loop and the connection readers, which may outlive it
+struct ServerState
+{
+    ServerState(int numThreads, const JobFunc& _runJob) : queue(numThreads), runJob(_runJob) {
+        responses.resize(queue.numThreads());
+    }
+
+    WorkQueue queue;
+    JobFunc runJob;
+    vector<string> responses; // per worker, reused between jobs
+    atomic<bool> stopping{false};
+    string socketPath;
+};
+
+static bool makeAddr(const string& socketPath, sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr->sun_path))
+        return false;
+    strcpy(addr->sun_path, socketPath.c_str());
+    return true;
+}
+
+// accept() is not reliably interrupted by closing the socket, connecting to it is
+static void wakeAccept(const string& socketPath)
+{
+    sockaddr_un addr;
+    makeAddr(socketPath, &addr);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return;
+    connect(fd, (sockaddr*)&addr, sizeof(addr));
+    close(fd);
+}
+
+// arguments are separated by spaces, or only by tabs when the line has a tab. an argument in double quotes
+// may contain separators, a backslash in it escapes the next char. returns false for an unterminated quote
+static bool split(const string& line, vector<string>* args)
+{
+    const char* seps = (line.find('\t') != string::npos) ? "\t" : " ";
+    size_t i = 0;
+    while (true) {
+        while (i < line.size() && strchr(seps, line[i]))
+            ++i;
+        if (i == line.size())
+            return true;
+        string arg;
+        if (line[i] == '"') {
+            for(++i; i < line.size() && line[i] != '"'; ++i) {
+                if (line[i] == '\\' && i + 1 < line.size())
+                    ++i;
+                arg += line[i];
+            }
+            if (i == line.size())
+                return false;
+            ++i; // closing quote
+        }
+        else {
+            for(; i < line.size() && !strchr(seps, line[i]); ++i)
+                arg += line[i];
+        }
+        args->push_back(arg);
+    }
+}
+
+static void queueJob(const shared_ptr<ServerState>& state, const shared_ptr<Connection>& conn, const string& line)
+{
+    vector<string> args;
+    bool parsed = split(line, &args);
+    if (args.empty())
+        return;
+    string jobId = args[0];
+    args.erase(args.begin());
+    if (!parsed) {
+        string msg = "Unterminated quote in job line\n";
+        conn->send(jobId + " ERR " + to_string(msg.size()) + "\n" + msg);
+        return;
+    }
+
+    bool queued = state->queue.push([state, conn, jobId, args](int worker) {
+        ostringstream out;
+        bool ok = false;
+        try {
+            ok = state->runJob(args, out);
+        }
+        catch(const std::exception& e) {
+            out << e.what() << endl;
+        }
+        string output = out.str();
+        string& response = state->responses[worker];
+        response.clear();
+        response += jobId;
+        response += ok ? " OK " : " ERR ";
+        response += to_string(output.size());
+        response += "\n";
+        response += output;
+        conn->send(response);
+    });
+    if (!queued) {
+        string msg = "Server shutting down\n";
+        conn->send(jobId + " ERR " + to_string(msg.size()) + "\n" + msg);
+    }
+}
+
+static void readConnection(shared_ptr<ServerState> state, shared_ptr<Connection> conn)
+{
+    string pending;
+    char buf[4096];
+    while (true) {
+        ssize_t r = read(conn->fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break; // client closed the connection
+        pending.append(buf, (size_t)r);
+
+        size_t start = 0, end;
+        while ((end = pending.find('\n', start)) != string::npos) {
+            string line = pending.substr(start, end - start);
+            start = end + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line == "shutdown") {
+                state->stopping = true;
+                wakeAccept(state->socketPath);
+                return;
+            }
+            queueJob(state, conn, line);
+        }
+        pending.erase(0, start);
+    }
+}
+
+int serve(const string& socketPath, int numThreads, const JobFunc& runJob)
+{
+    // a client that disconnects before its response is written should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    CHECK(makeAddr(socketPath, &addr), "Socket path too long `" << socketPath << "`");
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(listenFd != -1, "Failed creating socket");
+    unlink(socketPath.c_str()); // left over from a previous run
+    if (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        close(listenFd);
+        CHECK(false, "Failed listening on `" << socketPath << "`");
+    }
+
+    auto state = make_shared<ServerState>(numThreads, runJob);
+    state->socketPath = socketPath;
+    cout << "Listening on " << socketPath << " with " << state->queue.numThreads() << " threads" << endl;
+
+    while (!state->stopping) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        if (state->stopping) {
+            close(fd);
+            break;
+        }
+        thread(readConnection, state, make_shared<Connection>(fd)).detach();
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    state->queue.finish(); // jobs already queued still get their response
+    cout << "Server stopped" << endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+// runs one job given its arguments, writes its output to out. returns false if the job failed
+typedef function<bool(const vector<string>& args, ostream& out)> JobFunc;
+
+// long running server that takes jobs over a unix domain socket and runs them on a pool of threads.
+// a client sends one line per job:  <job-id> <command> <args...>
+// an argument with spaces is put in double quotes, with a backslash before a quote or a backslash in it,
+// or the line is tab separated
+// for every job, in the order they finish, the server sends back:  <job-id> OK|ERR <output-size>\n<output>
+// the line "shutdown" stops the server after the jobs already queued are done
+int serve(const string& socketPath, int numThreads, const JobFunc& runJob);
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// fixed pool of worker threads that run jobs in the order they were pushed
+class WorkQueue
+{
+public:
+    // the job gets the index of the worker that runs it so it can reuse per-thread state
+    typedef function<void(int worker)> Job;
+
+    // 0 threads uses the number of cores
+    WorkQueue(int numThreads = 0) {
+        if (numThreads <= 0)
+            numThreads = (int)thread::hardware_concurrency();
+        if (numThreads <= 0)
+            numThreads = 1;
+        for(int i = 0; i < numThreads; ++i)
+            m_threads.push_back(thread([this, i]{ workerLoop(i); }));
+    }
+    ~WorkQueue() {
+        finish();
+    }
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    int numThreads() const {
+        return (int)m_threads.size();
+    }
+
+    // returns false if the queue was already finished
+    bool push(Job job) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (m_finished)
+                return false;
+            m_jobs.push_back(std::move(job));
+            ++m_pending;
+        }
+        m_jobAdded.notify_one();
+        return true;
+    }
+
+    // wait until all the jobs pushed so far are done
+    void wait() {
+        unique_lock<mutex> lock(m_mutex);
+        m_jobDone.wait(lock, [this]{ return m_pending == 0; });
+    }
+
+    // run what is left in the queue and stop the threads
+    void finish() {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_jobAdded.notify_all();
+        for(auto& t: m_threads) {
+            if (t.joinable())
+                t.join();
+        }
+    }
+
+private:
+    void workerLoop(int worker) {
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_jobAdded.wait(lock, [this]{ return m_finished || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                    return; // finished
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job(worker); // jobs are expected to catch their own exceptions
+            {
+                lock_guard<mutex> lock(m_mutex);
+                --m_pending;
+            }
+            m_jobDone.notify_all();
+        }
+    }
+
+    vector<thread> m_threads;
+    deque<Job> m_jobs;
+    mutex m_mutex;
+    condition_variable m_jobAdded;
+    condition_variable m_jobDone;
+    int m_pending = 0; // pushed and not done yet
+    bool m_finished = false;
+};
@@ -0,0 +1,818 @@
+#include <fstream>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include "Zip.h"
+#include "FileView.h"
+#include "Except.h"
+
+static const uint32_t* crcTable()
+{
+    static uint32_t table[256];
+    static bool init = [] {
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    return table;
+}
+
+uint32_t crc32(const void* data, size_t len, uint32_t crc)
+{
+    const uint32_t* table = crcTable();
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    for(size_t i = 0; i < len; ++i)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// inflate, RFC 1951
+
+#define MAX_BITS 15
+#define FAST_BITS 10
+
+// canonical huffman code. codes up to FAST_BITS long are decoded with one lookup, longer ones
+// bit by bit from the counts
+struct Huffman {
+    uint16_t fast[1 << FAST_BITS]; // symbol << 4 | length, 0 when the code is longer
+    uint16_t count[MAX_BITS + 1];  // number of codes of every length
+    uint16_t symbol[288];          // symbols ordered by code
+
+    void build(const uint8_t* lengths, int n)
+    {
+        memset(count, 0, sizeof(count));
+        for(int i = 0; i < n; ++i)
+            ++count[lengths[i]];
+        count[0] = 0;
+        int left = 1;
+        for(int len = 1; len <= MAX_BITS; ++len) {
+            left = (left << 1) - count[len];
+            CHECK(left >= 0, "Over-subscribed huffman code in deflate data");
+        }
+        uint16_t offs[MAX_BITS + 2];
+        offs[1] = 0;
+        for(int len = 1; len <= MAX_BITS; ++len)
+            offs[len + 1] = offs[len] + count[len];
+        for(int i = 0; i < n; ++i)
+            if (lengths[i] != 0)
+                symbol[offs[lengths[i]]++] = (uint16_t)i;
+
+        memset(fast, 0, sizeof(fast));
+        uint32_t code = 0;
+        int index = 0;
+        for(int len = 1; len <= FAST_BITS; ++len) {
+            for(int i = 0; i < count[len]; ++i, ++index, ++code) {
+                // the code is read from the low bit, so the table index is the code reversed
+                uint32_t rev = 0;
+                for(int b = 0; b < len; ++b)
+                    rev |= ((code >> b) & 1) << (len - 1 - b);
+                for(uint32_t j = rev; j < (1 << FAST_BITS); j += (1 << len))
+                    fast[j] = (uint16_t)(symbol[index] << 4 | len);
+            }
+            code <<= 1;
+        }
+    }
+};
+
+static const uint16_t LEN_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LEN_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+class Inflater
+{
+public:
+    Inflater(const char* data, size_t size, char* out, size_t outSize)
+        : m_in((const uint8_t*)data), m_inEnd((const uint8_t*)data + size), m_out(out), m_outPos(out), m_outEnd(out + outSize)
+    {}
+
+    void run()
+    {
+        bool last = false;
+        while (!last) {
+            last = bits(1) != 0;
+            int type = bits(2);
+            if (type == 0)
+                stored();
+            else if (type == 1)
+                fixed();
+            else if (type == 2)
+                dynamic();
+            else
+                CHECK(false, "Bad deflate block type");
+        }
+        CHECK(m_outPos == m_outEnd, "Deflate data is shorter than the entry size");
+    }
+
+private:
+    // reads whole bytes ahead, as many as fit so it's not done for every code
+    void fill(int n) {
+        if (m_bitCount >= n)
+            return;
+        while (m_bitCount <= 56 && m_in < m_inEnd) {
+            m_bitBuf |= (uint64_t)*m_in++ << m_bitCount;
+            m_bitCount += 8;
+        }
+    }
+    int bits(int n) {
+        fill(n);
+        CHECK(m_bitCount >= n, "Truncated deflate data");
+        int v = (int)(m_bitBuf & ((1u << n) - 1));
+        m_bitBuf >>= n;
+        m_bitCount -= n;
+        return v;
+    }
+
+    int decode(const Huffman& h) {
+        fill(MAX_BITS);
+        uint16_t e = h.fast[m_bitBuf & ((1 << FAST_BITS) - 1)];
+        if (e != 0) {
+            int len = e & 0xf;
+            CHECK(len <= m_bitCount, "Truncated deflate data");
+            m_bitBuf >>= len;
+            m_bitCount -= len;
+            return e >> 4;
+        }
+        // codes are consecutive within a length, first is the first code of the current length
+        int code = 0, first = 0, index = 0;
+        for(int len = 1; len <= MAX_BITS; ++len) {
+            CHECK(len <= m_bitCount, "Truncated deflate data");
+            code |= (int)(m_bitBuf >> (len - 1)) & 1;
+            int count = h.count[len];
+            if (code - count < first) {
+                m_bitBuf >>= len;
+                m_bitCount -= len;
+                return h.symbol[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        CHECK(false, "Bad huffman code in deflate data");
+        return 0;
+    }
+
+    void stored()
+    {
+        // the rest of the current byte is skipped, the bytes that were read ahead are copied first
+        m_bitBuf >>= m_bitCount & 7;
+        m_bitCount -= m_bitCount & 7;
+        int len = bits(16);
+        int nlen = bits(16);
+        CHECK(len == (~nlen & 0xffff), "Bad stored block length in deflate data");
+        CHECK(m_outEnd - m_outPos >= len, "Deflate data is longer than the entry size");
+        for(; len > 0 && m_bitCount > 0; --len) {
+            *m_outPos++ = (char)m_bitBuf;
+            m_bitBuf >>= 8;
+            m_bitCount -= 8;
+        }
+        CHECK(m_inEnd - m_in >= len, "Truncated deflate data");
+        memcpy(m_outPos, m_in, len);
+        m_in += len;
+        m_outPos += len;
+    }
+
+    void fixed()
+    {
+        uint8_t lengths[288 + 30];
+        int i = 0;
+        for(; i < 144; ++i)
+            lengths[i] = 8;
+        for(; i < 256; ++i)
+            lengths[i] = 9;
+        for(; i < 280; ++i)
+            lengths[i] = 7;
+        for(; i < 288; ++i)
+            lengths[i] = 8;
+        for(; i < 288 + 30; ++i)
+            lengths[i] = 5;
+        m_lit.build(lengths, 288);
+        m_dist.build(lengths + 288, 30);
+        codes();
+    }
+
+    void dynamic()
+    {
+        static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        int nlen = bits(5) + 257;
+        int ndist = bits(5) + 1;
+        int ncode = bits(4) + 4;
+        CHECK(nlen <= 286 && ndist <= 30, "Bad dynamic block counts in deflate data");
+
+        uint8_t lengths[288 + 30] = {0};
+        for(int i = 0; i < ncode; ++i)
+            lengths[ORDER[i]] = (uint8_t)bits(3);
+        m_lit.build(lengths, 19);
+
+        memset(lengths, 0, sizeof(lengths));
+        int index = 0;
+        while (index < nlen + ndist) {
+            int sym = decode(m_lit);
+            if (sym < 16) {
+                lengths[index++] = (uint8_t)sym;
+                continue;
+            }
+            uint8_t len = 0;
+            int rep = 0;
+            if (sym == 16) {
+                CHECK(index > 0, "Repeat with no previous length in deflate data");
+                len = lengths[index - 1];
+                rep = 3 + bits(2);
+            }
+            else if (sym == 17)
+                rep = 3 + bits(3);
+            else
+                rep = 11 + bits(7);
+            CHECK(index + rep <= nlen + ndist, "Too many lengths in deflate data");
+            while (rep-- > 0)
+                lengths[index++] = len;
+        }
+        CHECK(lengths[256] != 0, "No end of block code in deflate data");
+        m_lit.build(lengths, nlen);
+        m_dist.build(lengths + nlen, ndist);
+        codes();
+    }
+
+    void codes()
+    {
+        while (true) {
+            int sym = decode(m_lit);
+            if (sym < 256) {
+                CHECK(m_outPos < m_outEnd, "Deflate data is longer than the entry size");
+                *m_outPos++ = (char)sym;
+                continue;
+            }
+            if (sym == 256)
+                return;
+            sym -= 257;
+            CHECK(sym < 29, "Bad length code in deflate data");
+            int len = LEN_BASE[sym] + bits(LEN_EXTRA[sym]);
+            int dsym = decode(m_dist);
+            CHECK(dsym < 30, "Bad distance code in deflate data");
+            size_t dist = DIST_BASE[dsym] + bits(DIST_EXTRA[dsym]);
+            CHECK(dist <= (size_t)(m_outPos - m_out), "Distance too far back in deflate data");
+            CHECK(m_outEnd - m_outPos >= len, "Deflate data is longer than the entry size");
+            const char* from = m_outPos - dist;
+            if (dist >= (size_t)len)
+                memcpy(m_outPos, from, len);
+            else // overlapping, repeats the last dist bytes
+                for(int i = 0; i < len; ++i)
+                    m_outPos[i] = from[i];
+            m_outPos += len;
+        }
+    }
+
+    const uint8_t* m_in;
+    const uint8_t* m_inEnd;
+    uint64_t m_bitBuf = 0;
+    int m_bitCount = 0;
+    char* m_out;
+    char* m_outPos;
+    char* m_outEnd;
+    Huffman m_lit, m_dist;
+};
+
+void inflate(const char* data, size_t size, char* out, size_t outSize)
+{
+    Inflater inf(data, size, out, outSize);
+    inf.run();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// deflate
+
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define MAX_CHAIN 16 // match candidates tried at every position
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define BLOCK_TOKENS 32768
+
+class BitWriter
+{
+public:
+    BitWriter(string* out) : m_out(out) {}
+    // bits are packed from the low bit
+    void put(uint32_t v, int n) {
+        m_buf |= (uint64_t)v << m_count;
+        m_count += n;
+        if (m_count >= 32) {
+            char b[4] = { (char)m_buf, (char)(m_buf >> 8), (char)(m_buf >> 16), (char)(m_buf >> 24) };
+            m_out->append(b, 4);
+            m_buf >>= 32;
+            m_count -= 32;
+        }
+    }
+    void flush() {
+        for(; m_count > 0; m_count -= 8) {
+            *m_out += (char)m_buf;
+            m_buf >>= 8;
+        }
+        m_buf = 0;
+        m_count = 0;
+    }
+private:
+    string* m_out;
+    uint64_t m_buf = 0;
+    int m_count = 0;
+};
+
+// huffman code lengths for the frequencies, no longer than maxBits. when the tree is too deep the
+// frequencies are flattened and it's built again
+static void buildLengths(const uint32_t* freqIn, int n, int maxBits, uint8_t* lengths)
+{
+    vector<uint32_t> freq(freqIn, freqIn + n);
+    int used = 0;
+    for(int i = 0; i < n; ++i)
+        used += (freq[i] != 0);
+    // a code needs at least two symbols to be complete
+    for(int i = 0; used < 2 && i < n; ++i) {
+        if (freq[i] == 0) {
+            freq[i] = 1;
+            ++used;
+        }
+    }
+    vector<int> parent(2 * n);
+    while (true) {
+        // min heap of (freq, node), leaves are 0..n-1 and inner nodes from n
+        vector<pair<uint32_t, int>> heap;
+        for(int i = 0; i < n; ++i)
+            if (freq[i] != 0)
+                heap.push_back(make_pair(freq[i], i));
+        auto cmp = [](const pair<uint32_t, int>& a, const pair<uint32_t, int>& b) { return a > b; };
+        make_heap(heap.begin(), heap.end(), cmp);
+        int next = n;
+        while (heap.size() > 1) {
+            pop_heap(heap.begin(), heap.end(), cmp);
+            auto a = heap.back();
+            heap.pop_back();
+            pop_heap(heap.begin(), heap.end(), cmp);
+            auto b = heap.back();
+            heap.pop_back();
+            parent[a.second] = parent[b.second] = next;
+            heap.push_back(make_pair(a.first + b.first, next++));
+            push_heap(heap.begin(), heap.end(), cmp);
+        }
+        // inner nodes are created after their children so the depths can be filled from the root down
+        int root = next - 1;
+        vector<int> depth(next, 0);
+        for(int i = root - 1; i >= n; --i)
+            depth[i] = depth[parent[i]] + 1;
+        int maxLen = 0;
+        for(int i = 0; i < n; ++i) {
+            lengths[i] = (freq[i] == 0) ? 0 : (uint8_t)(depth[parent[i]] + 1);
+            maxLen = max(maxLen, (int)lengths[i]);
+        }
+        if (maxLen <= maxBits)
+            return;
+        for(auto& f: freq)
+            if (f != 0)
+                f = f / 2 + 1;
+    }
+}
+
+// canonical codes, reversed since they are written from the low bit
+static void buildCodes(const uint8_t* lengths, int n, uint16_t* codes)
+{
+    uint16_t count[MAX_BITS + 1] = {0}, next[MAX_BITS + 1];
+    for(int i = 0; i < n; ++i)
+        ++count[lengths[i]];
+    count[0] = 0;
+    uint32_t code = 0;
+    for(int len = 1; len <= MAX_BITS; ++len) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = (uint16_t)code;
+    }
+    for(int i = 0; i < n; ++i) {
+        int len = lengths[i];
+        if (len == 0)
+            continue;
+        uint32_t c = next[len]++, rev = 0;
+        for(int b = 0; b < len; ++b)
+            rev |= ((c >> b) & 1) << (len - 1 - b);
+        codes[i] = (uint16_t)rev;
+    }
+}
+
+static int highBit(uint32_t x) {
+    int n = 0;
+    while (x >>= 1)
+        ++n;
+    return n;
+}
+static int lengthCode(int len) {
+    int x = len - MIN_MATCH;
+    if (len == MAX_MATCH)
+        return 28;
+    if (x < 8)
+        return x;
+    int hb = highBit(x);
+    return 4 * (hb - 1) + ((x >> (hb - 2)) & 3);
+}
+static int distCode(int dist) {
+    int x = dist - 1;
+    if (x < 4)
+        return x;
+    int hb = highBit(x);
+    return 2 * hb + ((x >> (hb - 1)) & 1);
+}
+
+// a literal when dist is 0, otherwise a match
+struct Token {
+    uint16_t litLen;
+    uint16_t dist;
+};
+
+// one block with codes made for its tokens
+static void writeBlock(BitWriter& w, const vector<Token>& tokens, bool last)
+{
+    uint32_t litFreq[286] = {0}, distFreq[30] = {0};
+    for(const auto& t: tokens) {
+        if (t.dist == 0)
+            ++litFreq[t.litLen];
+        else {
+            ++litFreq[257 + lengthCode(t.litLen)];
+            ++distFreq[distCode(t.dist)];
+        }
+    }
+    litFreq[256] = 1;
+    uint8_t lengths[286 + 30];
+    buildLengths(litFreq, 286, MAX_BITS, lengths);
+    buildLengths(distFreq, 30, MAX_BITS, lengths + 286);
+    int nlit = 286, ndist = 30;
+    while (nlit > 257 && lengths[nlit - 1] == 0)
+        --nlit;
+    while (ndist > 1 && lengths[286 + ndist - 1] == 0)
+        --ndist;
+
+    // the lengths of both codes are sent together, with runs shortened by the repeat codes 16, 17, 18
+    uint8_t all[286 + 30];
+    memcpy(all, lengths, nlit);
+    memcpy(all + nlit, lengths + 286, ndist);
+    int total = nlit + ndist;
+    vector<pair<uint8_t, uint8_t>> clSyms; // symbol and its extra bits
+    uint32_t clFreq[19] = {0};
+    for(int i = 0; i < total;) {
+        int run = 1;
+        while (i + run < total && all[i + run] == all[i])
+            ++run;
+        int left = run;
+        if (all[i] == 0) {
+            while (left >= 11) {
+                int r = min(left, 138);
+                clSyms.push_back(make_pair(18, r - 11));
+                left -= r;
+            }
+            if (left >= 3) {
+                clSyms.push_back(make_pair(17, left - 3));
+                left = 0;
+            }
+        }
+        else {
+            clSyms.push_back(make_pair(all[i], 0));
+            --left;
+            while (left >= 3) {
+                int r = min(left, 6);
+                clSyms.push_back(make_pair(16, r - 3));
+                left -= r;
+            }
+        }
+        for(; left > 0; --left)
+            clSyms.push_back(make_pair(all[i], 0));
+        i += run;
+    }
+    for(const auto& s: clSyms)
+        ++clFreq[s.first];
+    uint8_t clLengths[19];
+    uint16_t clCodes[19];
+    buildLengths(clFreq, 19, 7, clLengths);
+    buildCodes(clLengths, 19, clCodes);
+    static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int ncode = 19;
+    while (ncode > 4 && clLengths[ORDER[ncode - 1]] == 0)
+        --ncode;
+
+    w.put(last ? 1 : 0, 1);
+    w.put(2, 2); // dynamic codes
+    w.put(nlit - 257, 5);
+    w.put(ndist - 1, 5);
+    w.put(ncode - 4, 4);
+    for(int i = 0; i < ncode; ++i)
+        w.put(clLengths[ORDER[i]], 3);
+    static const uint8_t CL_EXTRA[3] = { 2, 3, 7 };
+    for(const auto& s: clSyms) {
+        w.put(clCodes[s.first], clLengths[s.first]);
+        if (s.first >= 16)
+            w.put(s.second, CL_EXTRA[s.first - 16]);
+    }
+
+    uint16_t litCodes[286], distCodes[30];
+    buildCodes(lengths, 286, litCodes);
+    buildCodes(lengths + 286, 30, distCodes);
+    for(const auto& t: tokens) {
+        if (t.dist == 0) {
+            w.put(litCodes[t.litLen], lengths[t.litLen]);
+            continue;
+        }
+        int lc = lengthCode(t.litLen);
+        w.put(litCodes[257 + lc], lengths[257 + lc]);
+        w.put(t.litLen - LEN_BASE[lc], LEN_EXTRA[lc]);
+        int dc = distCode(t.dist);
+        w.put(distCodes[dc], lengths[286 + dc]);
+        w.put(t.dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+    }
+    w.put(litCodes[256], lengths[256]);
+}
+
+static inline uint32_t hash3(const uint8_t* p) {
+    return ((p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// greedy matching over hash chains
+void deflate(const char* data, size_t size, string* out)
+{
+    out->clear();
+    out->reserve(size / 2 + 64);
+    BitWriter w(out);
+
+    const uint8_t* in = (const uint8_t*)data;
+    vector<int> head(1 << HASH_BITS, -1);
+    vector<int> prev(WINDOW_SIZE, -1);
+    auto insert = [&](size_t pos) {
+        uint32_t h = hash3(in + pos);
+        prev[pos & (WINDOW_SIZE - 1)] = head[h];
+        head[h] = (int)pos;
+    };
+
+    vector<Token> tokens;
+    tokens.reserve(BLOCK_TOKENS);
+    size_t pos = 0;
+    while (pos < size) {
+        int bestLen = 0, bestDist = 0;
+        if (pos + MIN_MATCH <= size) {
+            size_t maxLen = min((size_t)MAX_MATCH, size - pos);
+            int cand = head[hash3(in + pos)];
+            for(int chain = 0; cand >= 0 && chain < MAX_CHAIN && pos - cand <= WINDOW_SIZE; ++chain) {
+                const uint8_t* a = in + cand;
+                const uint8_t* b = in + pos;
+                if (a[bestLen] == b[bestLen]) { // can't be longer otherwise
+                    size_t len = 0;
+                    uint64_t x, y;
+                    for(; len + 8 <= maxLen; len += 8) {
+                        memcpy(&x, a + len, 8);
+                        memcpy(&y, b + len, 8);
+                        if (x != y)
+                            break;
+                    }
+                    while (len < maxLen && a[len] == b[len])
+                        ++len;
+                    if ((int)len > bestLen) {
+                        bestLen = (int)len;
+                        bestDist = (int)(pos - cand);
+                        if (len == maxLen)
+                            break;
+                    }
+                }
+                int next = prev[cand & (WINDOW_SIZE - 1)];
+                if (next >= cand)
+                    break; // the slot was reused by a newer position
+                cand = next;
+            }
+            insert(pos);
+        }
+
+        if (bestLen >= MIN_MATCH) {
+            tokens.push_back({ (uint16_t)bestLen, (uint16_t)bestDist });
+            for(size_t i = pos + 1; i < pos + bestLen && i + MIN_MATCH <= size; ++i)
+                insert(i);
+            pos += bestLen;
+        }
+        else {
+            tokens.push_back({ in[pos], 0 });
+            ++pos;
+        }
+        if (tokens.size() == BLOCK_TOKENS && pos < size) {
+            writeBlock(w, tokens, false);
+            tokens.clear();
+        }
+    }
+    writeBlock(w, tokens, true);
+    w.flush();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// archive
+
+// zip fields are little endian regardless of the machine
+static uint32_t get16(const char* p) {
+    return (uint8_t)p[0] | ((uint8_t)p[1] << 8);
+}
+static uint32_t get32(const char* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+static void put16(string* s, uint32_t v) {
+    *s += (char)(v & 0xff);
+    *s += (char)((v >> 8) & 0xff);
+}
+static void put32(string* s, uint32_t v) {
+    put16(s, v & 0xffff);
+    put16(s, v >> 16);
+}
+
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP_END_SIZE 22
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+
+ZipReader::ZipReader(const string& filename) : m_filename(filename), m_file(make_shared<FileView>(filename))
+{
+    const char* data = m_file->data();
+    size_t size = m_file->size();
+
+    // the end record is last, followed by a comment of up to 64K
+    CHECK(size >= ZIP_END_SIZE, "Not a zip file `" << filename << "`");
+    size_t endPos = size - ZIP_END_SIZE;
+    size_t minPos = (size > ZIP_END_SIZE + 0xffff) ? size - ZIP_END_SIZE - 0xffff : 0;
+    while (get32(data + endPos) != ZIP_END_SIG) {
+        CHECK(endPos > minPos, "Not a zip file `" << filename << "`");
+        --endPos;
+    }
+    const char* end = data + endPos;
+    size_t count = get16(end + 10);
+    size_t cdSize = get32(end + 12);
+    size_t cdOffset = get32(end + 16);
+    CHECK(count != 0xffff && cdOffset != 0xffffffff, "Zip64 is not supported `" << filename << "`");
+    CHECK(cdOffset + cdSize <= endPos, "Bad central directory in `" << filename << "`");
+
+    const char* p = data + cdOffset;
+    const char* cdEnd = p + cdSize;
+    m_entries.resize(count);
+    for(auto& e: m_entries) {
+        CHECK(cdEnd - p >= ZIP_CENTRAL_SIZE && get32(p) == ZIP_CENTRAL_SIG, "Bad central directory in `" << filename << "`");
+        int flags = get16(p + 8);
+        e.method = get16(p + 10);
+        e.crc = get32(p + 16);
+        e.compSize = get32(p + 20);
+        e.size = get32(p + 24);
+        size_t nameLen = get16(p + 28), extraLen = get16(p + 30), commentLen = get16(p + 32);
+        e.localOffset = get32(p + 42);
+        CHECK((size_t)(cdEnd - p) >= ZIP_CENTRAL_SIZE + nameLen + extraLen + commentLen, "Bad central directory in `" << filename << "`");
+        e.name.assign(p + ZIP_CENTRAL_SIZE, nameLen);
+        CHECK((flags & 1) == 0, "Encrypted zip entry `" << e.name << "` in `" << filename << "`");
+        p += ZIP_CENTRAL_SIZE + nameLen + extraLen + commentLen;
+    }
+}
+
+const char* ZipReader::read(const ZipEntry& e, string* buf) const
+{
+    const char* data = m_file->data();
+    size_t size = m_file->size();
+    CHECK(e.localOffset + ZIP_LOCAL_SIZE <= size && get32(data + e.localOffset) == ZIP_LOCAL_SIG,
+          "Bad local header of `" << e.name << "` in `" << m_filename << "`");
+    // the local name and extra can differ from the central directory ones
+    const char* local = data + e.localOffset;
+    size_t start = e.localOffset + ZIP_LOCAL_SIZE + get16(local + 26) + get16(local + 28);
+    CHECK(start + e.compSize <= size, "Truncated entry `" << e.name << "` in `" << m_filename << "`");
+
+    const char* out = nullptr;
+    if (e.method == 0) {
+        CHECK(e.compSize == e.size, "Bad stored entry `" << e.name << "` in `" << m_filename << "`");
+        out = data + start;
+    }
+    else if (e.method == 8) {
+        buf->resize(e.size);
+        try {
+            inflate(data + start, e.compSize, &(*buf)[0], e.size);
+        }
+        catch (const Exception& ex) {
+            CHECK(false, ex.what() << " in `" << e.name << "` in `" << m_filename << "`");
+        }
+        out = buf->data();
+    }
+    else
+        CHECK(false, "Unsupported compression method " << e.method << " of `" << e.name << "` in `" << m_filename << "`");
+
+    CHECK(crc32(out, e.size) == e.crc, "Bad crc of `" << e.name << "` in `" << m_filename << "`");
+    return out;
+}
+
+ZipWriter::ZipWriter(const string& filename, bool compress)
+    : m_filename(filename), m_compress(compress), m_out(filename, ios::binary)
+{
+    CHECK(m_out.good(), "Failed opening file `" << filename << "`");
+    time_t now = time(nullptr);
+    struct tm* t = localtime(&now);
+    m_dosTime = (uint16_t)((t->tm_hour << 11) | (t->tm_min << 5) | (t->tm_sec / 2));
+    m_dosDate = (uint16_t)(((t->tm_year - 80) << 9) | ((t->tm_mon + 1) << 5) | t->tm_mday);
+}
+
+void ZipWriter::add(size_t index, const string& name, const string& data)
+{
+    CHECK(data.size() < 0xffffffff, "Zip64 is not supported, `" << name << "` is too big");
+    Pending p;
+    p.e.name = name;
+    p.e.size = data.size();
+    p.e.crc = crc32(data.data(), data.size());
+    if (m_compress) {
+        deflate(data.data(), data.size(), &p.data);
+        p.e.method = 8;
+    }
+    if (!m_compress || p.data.size() >= data.size()) {
+        p.data = data;
+        p.e.method = 0;
+    }
+    p.e.compSize = p.data.size();
+
+    lock_guard<mutex> lock(m_mutex);
+    CHECK(index >= m_next && m_pending.count(index) == 0, "Zip entry " << index << " added twice");
+    m_pending[index] = std::move(p);
+    for(auto it = m_pending.begin(); it != m_pending.end() && it->first == m_next; it = m_pending.erase(it)) {
+        writeEntry(it->second);
+        ++m_next;
+    }
+}
+
+void ZipWriter::writeEntry(Pending& p)
+{
+    ZipEntry& e = p.e;
+    e.localOffset = m_offset;
+    CHECK(m_offset + ZIP_LOCAL_SIZE + e.name.size() + e.compSize < 0xffffffff, "Zip64 is not supported, `" << m_filename << "` is too big");
+    string header;
+    put32(&header, ZIP_LOCAL_SIG);
+    put16(&header, 20); // version needed, 2.0 for deflate
+    put16(&header, 0);  // flags
+    put16(&header, e.method);
+    put16(&header, m_dosTime);
+    put16(&header, m_dosDate);
+    put32(&header, e.crc);
+    put32(&header, (uint32_t)e.compSize);
+    put32(&header, (uint32_t)e.size);
+    put16(&header, (uint32_t)e.name.size());
+    put16(&header, 0);  // extra
+    header += e.name;
+    m_out.write(header.data(), header.size());
+    m_out.write(p.data.data(), p.data.size());
+    CHECK(m_out.good(), "Failed writing file `" << m_filename << "`");
+    m_offset += header.size() + p.data.size();
+    p.data = string(); // the central directory needs only the entry
+    m_entries.push_back(std::move(e));
+}
+
+void ZipWriter::close()
+{
+    lock_guard<mutex> lock(m_mutex);
+    CHECK(m_pending.empty(), "Zip entry " << m_next << " was not added to `" << m_filename << "`");
+    CHECK(m_entries.size() < 0xffff, "Zip64 is not supported, too many entries in `" << m_filename << "`");
+    string cd;
+    for(const auto& e: m_entries) {
+        put32(&cd, ZIP_CENTRAL_SIG);
+        put16(&cd, 20); // made by, msdos attributes
+        put16(&cd, 20); // version needed
+        put16(&cd, 0);  // flags
+        put16(&cd, e.method);
+        put16(&cd, m_dosTime);
+        put16(&cd, m_dosDate);
+        put32(&cd, e.crc);
+        put32(&cd, (uint32_t)e.compSize);
+        put32(&cd, (uint32_t)e.size);
+        put16(&cd, (uint32_t)e.name.size());
+        put16(&cd, 0);  // extra
+        put16(&cd, 0);  // comment
+        put16(&cd, 0);  // disk
+        put16(&cd, 0);  // internal attributes
+        put32(&cd, 0);  // external attributes
+        put32(&cd, (uint32_t)e.localOffset);
+        cd += e.name;
+    }
+    put32(&cd, ZIP_END_SIG);
+    put16(&cd, 0); // disk
+    put16(&cd, 0); // disk with the central directory
+    put16(&cd, (uint32_t)m_entries.size());
+    put16(&cd, (uint32_t)m_entries.size());
+    put32(&cd, (uint32_t)(cd.size() - 4 - 2 * 2 - 2 * 2));
+    put32(&cd, (uint32_t)m_offset);
+    put16(&cd, 0); // comment
+    m_out.write(cd.data(), cd.size());
+    m_out.close();
+    CHECK(m_out.good(), "Failed writing file `" << m_filename << "`");
+}
+
+bool isZipFile(const string& filename)
+{
+    ifstream inf(filename, ios::binary);
+    char sig[4];
+    if (!inf.read(sig, 4))
+        return false;
+    return get32(sig) == ZIP_LOCAL_SIG || get32(sig) == ZIP_END_SIG; // an empty archive is only the end record
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+class FileView;
+
+uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
+
+// decompresses raw deflate data (no zlib header) into out, which needs to be exactly outSize
+void inflate(const char* data, size_t size, char* out, size_t outSize);
+// compresses to raw deflate data, greedy matching with a short search so it stays fast
+void deflate(const char* data, size_t size, string* out);
+
+struct ZipEntry {
+    string name; // with the path inside the archive
+    int method = 0; // 0 stored, 8 deflate
+    uint32_t crc = 0;
+    size_t compSize = 0;
+    size_t size = 0;
+    size_t localOffset = 0; // of the local header
+};
+
+// reads zip archives from a mapped file without extracting them to disk. only stored and deflate entries,
+// no encryption, no zip64
+class ZipReader
+{
+public:
+    ZipReader(const string& filename);
+
+    const vector<ZipEntry>& entries() const {
+        return m_entries;
+    }
+    // the uncompressed data of the entry, e.size bytes. stored entries point into the mapped file, deflate
+    // entries are decompressed into buf. the crc is checked. can be called from several threads
+    const char* read(const ZipEntry& e, string* buf) const;
+
+private:
+    string m_filename;
+    shared_ptr<FileView> m_file;
+    vector<ZipEntry> m_entries;
+};
+
+// writes a zip archive from several threads. entries are written in the order of their index as soon as
+// all the ones before them were added, later ones wait in memory. compressing is done by the adding thread
+class ZipWriter
+{
+public:
+    // with compress, entries are deflated unless that doesn't make them smaller
+    ZipWriter(const string& filename, bool compress);
+    ZipWriter(const ZipWriter&) = delete;
+    ZipWriter& operator=(const ZipWriter&) = delete;
+
+    // every index from 0 needs to be added once
+    void add(size_t index, const string& name, const string& data);
+    // writes the central directory. the archive is not valid without it
+    void close();
+
+private:
+    struct Pending {
+        ZipEntry e;
+        string data; // compressed
+    };
+    void writeEntry(Pending& p);
+
+    string m_filename;
+    bool m_compress;
+    ofstream m_out;
+    mutex m_mutex;
+    map<size_t, Pending> m_pending;
+    size_t m_next = 0;
+    size_t m_offset = 0;
+    vector<ZipEntry> m_entries;
+    uint16_t m_dosTime = 0, m_dosDate = 0;
+};
+
+bool isZipFile(const string& filename);
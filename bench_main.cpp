@@ -0,0 +1,160 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+
+#include "Except.h"
+#include "Mesh.h"
+#include "MeshBuilder.h"
+#include "NullStream.h"
+#include "QuadGrid.h"
+
+using namespace std;
+
+// benchmark of the main phases on synthetic meshes. every phase is timed on its own, on a freshly parsed mesh,
+// and the fastest of the iterations is reported so that the numbers are stable enough to see regressions
+
+struct BenchMesh {
+    string name;
+    string data;
+    bool terrain; // tile with flat quads, for cullFaces and quad solving
+};
+
+static int g_iterations = 5;
+
+static double nowMs() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void parseMesh(const BenchMesh& bm, Mesh* m) {
+    MemIStream in(bm.data.data(), bm.data.size());
+    m->parse(in, nullptr);
+}
+
+static void report(const BenchMesh& bm, const string& phase, double ms, size_t bytes, int numVtx)
+{
+    double sec = ms / 1000.0;
+    cout << left << setw(12) << bm.name << setw(18) << phase << right << fixed
+         << setprecision(3) << setw(10) << ms << " ms"
+         << setprecision(1) << setw(10) << bytes / sec / (1024.0 * 1024.0) << " MB/s"
+         << setprecision(2) << setw(10) << numVtx / sec / 1e6 << " Mvtx/s" << endl;
+}
+
+// prepare runs on a fresh mesh outside of the timing
+static void bench(const BenchMesh& bm, const string& phase, const function<void(Mesh&)>& prepare, const function<void(Mesh&)>& run)
+{
+    double best = 0.0;
+    int numVtx = 0;
+    for(int i = 0; i < g_iterations; ++i) {
+        Mesh m;
+        parseMesh(bm, &m);
+        numVtx = m.countVtx();
+        if (prepare)
+            prepare(m);
+        double start = nowMs();
+        run(m);
+        double ms = nowMs() - start;
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    report(bm, phase, best, bm.data.size(), numVtx);
+}
+
+static void benchParse(const BenchMesh& bm)
+{
+    double best = 0.0;
+    int numVtx = 0;
+    for(int i = 0; i < g_iterations; ++i) {
+        Mesh m;
+        double start = nowMs();
+        parseMesh(bm, &m);
+        double ms = nowMs() - start;
+        numVtx = m.countVtx();
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    report(bm, "parse", best, bm.data.size(), numVtx);
+}
+
+// the decode kernels are validated against the reference decoder. parse does it only in debug builds
+static void checkDecode(const BenchMesh& bm)
+{
+    Mesh m;
+    parseMesh(bm, &m);
+    m.checkDecode();
+}
+
+static void benchLoadSnapshot(const BenchMesh& bm)
+{
+    Mesh parsed;
+    parseMesh(bm, &parsed);
+    string snap;
+    parsed.saveSnapshot(&snap);
+    double best = 0.0;
+    for(int i = 0; i < g_iterations; ++i) {
+        Mesh m;
+        double start = nowMs();
+        m.loadSnapshot(snap.data(), snap.size());
+        double ms = nowMs() - start;
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    report(bm, "loadSnapshot", best, snap.size(), parsed.countVtx());
+}
+
+// the most zoomed out and the normal eye directions, same as terrainProcess
+static const vector<Vec3> g_eyes = { Vec3{-0.122788f, -0.984808f, -0.122788f}, Vec3{-0.40558f, -0.819152f, -0.40558f}, Vec3{-0.612372f, -0.5f, -0.612372f} };
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && (string(argv[1]) == "-h" || string(argv[1]) == "--help")) {
+        cout << "Usage: ogre_bench [iterations] [scale]" << endl;
+        return 1;
+    }
+    if (argc > 1)
+        g_iterations = max(1, atoi(argv[1]));
+    int scale = (argc > 2) ? max(1, atoi(argv[2])) : 1;
+
+    try {
+        vector<BenchMesh> meshes = {
+            { "grid", MeshBuilder::gridTile(64 * scale), true },
+            { "skinned", MeshBuilder::skinned(20000 * scale, 30000 * scale, 40), false },
+            { "multibuf", MeshBuilder::multiBuffer(8, 4000 * scale, 6000 * scale), false },
+        };
+
+        for(const auto& bm: meshes) {
+            checkDecode(bm);
+            benchParse(bm);
+            benchLoadSnapshot(bm);
+            bench(bm, "dupsExact", nullptr, [](Mesh& m) { m.dupsExact(); });
+            bench(bm, "dupsByTanEpsilon", nullptr, [](Mesh& m) { m.dupsByTanEpsilon(0.0); });
+            if (bm.terrain) {
+                // the progress the phases print is not what is measured
+                bench(bm, "cullFaces", nullptr, [](Mesh& m) { m.cullFaces(g_eyes, null_stream()); });
+                // the grids are extracted outside of the timing, only solving is measured
+                vector<QuadGrid> grids;
+                bench(bm, "QuadGrid::solve", [&grids](Mesh& m) {
+                    grids.clear();
+                    for(float h: m.getPlaneHeights()) {
+                        grids.push_back(QuadGrid());
+                        if (!m.extractQuads(h, &grids.back(), null_stream()))
+                            grids.pop_back();
+                    }
+                }, [&grids](Mesh&) {
+                    for(auto& grid: grids)
+                        grid.solve(null_stream());
+                });
+            }
+            bench(bm, "save", nullptr, [](Mesh& m) {
+                string buf;
+                m.serialize(&buf);
+            });
+        }
+    }
+    catch(const std::exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
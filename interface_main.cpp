@@ -2,6 +2,8 @@
 
 #include "IMeshAnalyzer.h"
 #include "MeshAnalyzer.h"
+#include "ResultCache.h"
+#include "Profile.h"
 
 using namespace std;
 
@@ -14,52 +16,92 @@ static string basename(const string& path) {
 }
 
 
+// one analyzer for every thread, reused by the jobs a server worker runs. the mesh is not kept after the job
+class ThreadAnalyzer
+{
+public:
+    ThreadAnalyzer() {
+        if (!t_analyzer)
+            t_analyzer.reset(new MeshAnalyzer());
+    }
+    ~ThreadAnalyzer() {
+        t_analyzer->getMesh()->clear();
+    }
+    MeshAnalyzer* operator->() {
+        return t_analyzer.get();
+    }
+private:
+    static thread_local unique_ptr<MeshAnalyzer> t_analyzer;
+};
+thread_local unique_ptr<MeshAnalyzer> ThreadAnalyzer::t_analyzer;
 
-int analyzer_main(const string& filename, const string& outdir)
+
+// the cache is shared by all the files of a run, its totals are printed by the caller at the end
+int analyzer_main(const string& filename, const string& outdir, ResultCache& cache, ostream& out)
 {
+    ScopedProfileFile profileFile(filename);
     try {
-        auto ma = createMeshAnalyzer();
+        const vector<string> procs = { "just_unify", "unify_by_tan_epsilon", "merge_vertex_buffers", "merge_submeshes" };
+        string outpath = outdir + basename(filename);
+
+        // reused between calls so that a server worker doesn't allocate them again for every job
+        static thread_local string indata, outdata;
+        string cacheKey;
+        CHECK(readFile(filename, &indata), "Failed reading file `" << filename << "`");
+        if (cache.enabled()) {
+            string params = "optimize";
+            for(const auto& name: procs)
+                params += " " + name;
+            params += " epsilon=default";
+            cacheKey = cache.makeKey(indata, params);
+            if (cache.get(cacheKey, &outdata)) {
+                out << "CACHED " << outpath << endl;
+                writeFile(outpath, outdata);
+                return 0;
+            }
+        }
+
+        ThreadAnalyzer ma;
         //ma->setLogOut(&cout);
-        ma->parse(filename);
+        istringstream inf(indata);
+        ma->parse(inf);
         int numVtx = 0, sizeBytes = 0;
         ma->getStats(&numVtx, &sizeBytes);
-        cout << "VtxCount= " << numVtx << "  Size=" << sizeBytes << endl;
+        out << "VtxCount= " << numVtx << "  Size=" << sizeBytes << endl;
 
         auto vi = ma->analyze();
-        cout << "Messages:\n" << ma->getMessages() << endl;
+        out << "Messages:\n" << ma->getMessages() << endl;
 
         for(auto* i: vi) {
-            cout << "Name= " << i->getName() << endl;
-            cout << "  Desc= " << i->getDescription() << endl;
+            out << "Name= " << i->getName() << endl;
+            out << "  Desc= " << i->getDescription() << endl;
             int thisNumVtx = 0, thisSizeBytes = 0;
             i->getAfterStats(&thisNumVtx, &thisSizeBytes);
-            cout << "  VtxCount=" << thisNumVtx << " (" << (float)thisNumVtx / numVtx * 100.0 << "%)  Size=" << thisSizeBytes << " (" << (float)thisSizeBytes / sizeBytes * 100.0 << "%)" << endl;
-            cout << endl;
+            out << "  VtxCount=" << thisNumVtx << " (" << (float)thisNumVtx / numVtx * 100.0 << "%)  Size=" << thisSizeBytes << " (" << (float)thisSizeBytes / sizeBytes * 100.0 << "%)" << endl;
+            out << endl;
         }
 
-        cout << "RUNNING just_unify" << endl;
-        ma->runProc("just_unify");
-
-        cout << "RUNNING unify_by_tan_epsilon" << endl;
-        ma->runProc("unify_by_tan_epsilon");
-        cout << "RUNNING merge_vertex_buffers" << endl;
-        ma->runProc("merge_vertex_buffers");
+        out << "RUNNING just_unify, unify_by_tan_epsilon, merge_vertex_buffers, merge_submeshes" << endl;
+        ma->runProcs(procs);
 
-        string outpath = outdir + basename(filename);
-
-        cout << "SAVING " << outpath << endl;
-        ma->save(outpath);
+        out << "SAVING " << outpath << endl;
+        ostringstream outf;
+        ma->save(outf);
+        outdata = outf.str();
+        writeFile(outpath, outdata);
+        cache.put(cacheKey, outdata);
     }
     catch(const std::exception& e) {
-        cout << e.what() << endl;
+        out << e.what() << endl;
+        return 1;
     }
     return 0;
 }
 
-void printAnalyzeStats(const string& filename)
+int printAnalyzeStats(const string& filename, ostream& out)
 {
     try {
-        auto ma = createMeshAnalyzer();
+        ThreadAnalyzer ma;
         ma->parse(filename);
 
         int numVtx = 0, sizeBytes = 0;
@@ -83,14 +125,15 @@ void printAnalyzeStats(const string& filename)
 
         bool red = (hasTan && numPerc < 90.0) || needMerge;
         if (red)
-            cout << "\x1b[1;31;40m";
-        cout << filename << "  " << numVtx << "  " << tanNumVtx << "  " << numPerc << "  " << (needMerge ? "NEED-MERGE":"no-merge") << endl;
+            out << "\x1b[1;31;40m";
+        out << filename << "  " << numVtx << "  " << tanNumVtx << "  " << numPerc << "  " << (needMerge ? "NEED-MERGE":"no-merge") << endl;
         if (red)
-            cout << "\x1b[0m";
+            out << "\x1b[0m";
 
     }
     catch(const std::exception& e) {
-        cout << e.what() << endl;
+        out << e.what() << endl;
+        return 1;
     }
-
+    return 0;
 }
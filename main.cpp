@@ -1,6 +1,8 @@
 #include <iostream>
 #include <string>
 #include <string.h>
+#include <algorithm>
+#include <cfloat>
 
 #ifdef _WIN32
   #include "win_glob.h"
@@ -14,11 +16,20 @@
 #include "Mesh.h"
 #include "NullStream.h"
 #include "QuadGrid.h"
+#include "ResultCache.h"
+#include "Server.h"
+#include "Profile.h"
+#include "ObjWriter.h"
+#include "ObjReader.h"
+#include "WorkQueue.h"
+#include "MeshBuilder.h"
+#include "FileView.h"
+#include "Zip.h"
 
 
 // TBD:
 
-// endians?
+// V endians
 // reaper
 // when removing indices:
 // V   bone assignments with vertex index
@@ -45,89 +56,246 @@ static string basename(const string& path) {
 }
 
 
+// merges OBJ files to one, the indices of every file continue from the files before it
 class ObjMesh
 {
 public:
-    ObjMesh(const string& outname) {
-        m_outf.open(outname);
+    ObjMesh(const string& outname) : m_outf(outname, ios::binary), m_writer(&m_outf) {
         CHECK(m_outf.good(), "failed open");
-
     }
     void addFile(const string& s);
 
     ofstream m_outf;
-    int m_curOffset = 0;
+    ObjWriter m_writer; // after the file so it writes what's left before the file is closed
+    ObjData m_obj; // reused between the files
+    uint m_vOffset = 0, m_vtOffset = 0, m_vnOffset = 0;
 };
 
 void ObjMesh::addFile(const string& s)
 {
-    ifstream ifs(s);
-    if (!ifs.good())
-        return;
-    int vcount = 0;
-    while (!ifs.eof()) {
-        string line;
-        std::getline(ifs, line);
-        istringstream ss(line);
-        char cmd;
-        ss >> cmd;
-        if (cmd == 'v') {
-            ++vcount;
-            m_outf << line << "\n";
-        }
-        else if (cmd == 'f') {
-            int a, b, c;
-            ss >> a >> b >> c;
-            m_outf << "f " << a + m_curOffset << " " << b + m_curOffset << " " << c + m_curOffset << "\n";
-        }
-        else {
-            cout << "bad cmd `" << cmd << "`";
-        }
-    }
-    m_curOffset += vcount;
+    readObjFile(s, m_obj);
+    for(const auto& v: m_obj.pos)
+        m_writer.writePosition(v);
+    for(const auto& v: m_obj.tex)
+        m_writer.writeTexCoord(v);
+    for(const auto& v: m_obj.normal)
+        m_writer.writeNormal(v);
+    for(size_t i = 0; i < m_obj.corners.size(); i += 3)
+        m_writer.writeTriangle(&m_obj.corners[i], m_vOffset, m_vtOffset, m_vnOffset);
+    m_vOffset += (uint)m_obj.pos.size();
+    m_vtOffset += (uint)m_obj.tex.size();
+    m_vnOffset += (uint)m_obj.normal.size();
 }
 
-void unifyObjs(const string& path)
+// merges all the OBJ files in a folder
+int unifyObjs(const string& path, const string& outfile, ostream& out)
 {
     string filename;
-    filename = path + "/t_*.mesh.obj";
+    filename = path + "/*.obj";
 
     glob_t globbuf;
     glob(filename.c_str(), 0, NULL, &globbuf);
 
-    ObjMesh omesh("./ater.obj");
+    ObjMesh omesh(outfile);
     for(int i = 0; i < globbuf.gl_pathc; ++i)
     {
         filename = globbuf.gl_pathv[i];
-        cout << i << ", " << filename << ",   " << endl;
+        if (filename == outfile)
+            continue;
+        out << i << ", " << filename << ",   " << endl;
 
         omesh.addFile(filename);
     }
+    return 0;
+}
+
+// a tile of convertToObj, filled by the worker that converts it
+struct ObjTile {
+    uint numVtx = 0;
+    bool hasBase = false; // the vertex counts of all the tiles before it are known
+    uint base = 0;
+    bool done = false;
+    string text;
+    exception_ptr error;
+};
 
+// the tiles are parsed and formatted in parallel and written in the order of the files. the vertex indices
+// of a tile continue from the tiles before it so it waits only for their vertex counts, not their text.
+// parseTile parses the tile with the given index, from any thread
+static void writeTilesObj(const vector<string>& files, const function<void(size_t, Mesh&)>& parseTile,
+                          const string& outfile, ostream& out, int numThreads)
+{
+    ofstream outf(outfile, ios::binary);
+    CHECK(outf.good(), "Failed opening file `" << outfile << "`");
+
+    vector<ObjTile> tiles(files.size());
+    mutex tilesMutex;
+    condition_variable tileChanged;
+
+    WorkQueue queue(numThreads);
+    for(size_t i = 0; i < files.size(); ++i) {
+        // jobs start in order so the tiles before this one are already being converted
+        queue.push([&, i](int) {
+            ScopedProfileFile profFile(files[i]);
+            ObjTile& tile = tiles[i];
+            Mesh m;
+            uint numVtx = 0;
+            exception_ptr error;
+            try {
+                parseTile(i, m);
+                numVtx = m.countVtx();
+            }
+            catch (...) {
+                error = current_exception();
+            }
+
+            uint base = 0;
+            {
+                unique_lock<mutex> lock(tilesMutex);
+                tileChanged.wait(lock, [&]{ return i == 0 || tiles[i - 1].hasBase; });
+                if (i > 0)
+                    base = tiles[i - 1].base + tiles[i - 1].numVtx;
+                tile.numVtx = numVtx;
+                tile.base = base;
+                tile.hasBase = true;
+            }
+            tileChanged.notify_all();
+
+            string text;
+            if (!error) {
+                try {
+                    ScopedPhase phase("write");
+                    ObjWriter w;
+                    w.setAttributes(false);
+                    w.setVertexCount(base);
+                    w.writeMesh(m);
+                    text = w.takeBuffer();
+                    phase.setBytes(text.size());
+                }
+                catch (...) {
+                    error = current_exception();
+                }
+            }
+            {
+                lock_guard<mutex> lock(tilesMutex);
+                tile.text.swap(text);
+                tile.error = error;
+                tile.done = true;
+            }
+            tileChanged.notify_all();
+        });
+    }
+
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        string text;
+        exception_ptr error;
+        {
+            unique_lock<mutex> lock(tilesMutex);
+            tileChanged.wait(lock, [&]{ return tiles[i].done; });
+            text.swap(tiles[i].text);
+            error = tiles[i].error;
+        }
+        out << i << ", " << files[i] << ",   " << endl;
+        if (error)
+            rethrow_exception(error); // the queue goes before the tiles and waits for the jobs that use them
+        outf.write(text.data(), text.size());
+    }
+    CHECK(outf.good(), "Failed writing file `" << outfile << "`");
 }
 
-int convertToObj(const string& dir, const string& outfile)
+// the t_*.mesh entries of a mission pack zip, in the same order glob gives for an extracted folder
+static vector<const ZipEntry*> tileEntries(const ZipReader& zip)
 {
+    vector<const ZipEntry*> tiles;
+    for(const auto& e: zip.entries()) {
+        auto slash = e.name.rfind('/');
+        string name = (slash == string::npos) ? e.name : e.name.substr(slash + 1);
+        if (name.size() > 7 && name.compare(0, 2, "t_") == 0 && name.compare(name.size() - 5, 5, ".mesh") == 0)
+            tiles.push_back(&e);
+    }
+    sort(tiles.begin(), tiles.end(), [](const ZipEntry* a, const ZipEntry* b) { return a->name < b->name; });
+    return tiles;
+}
 
-    string filename = dir + "/t_*.mesh";
+// from a mission folder or a mission pack zip, which is read directly without extracting it
+int convertToObj(const string& dir, const string& outfile, ostream& out, int numThreads = 0)
+{
+    if (isZipFile(dir)) {
+        ZipReader zip(dir);
+        auto entries = tileEntries(zip);
+        vector<string> names;
+        for(const auto* e: entries)
+            names.push_back(dir + ":" + e->name);
+        writeTilesObj(names, [&](size_t i, Mesh& m) {
+            string buf;
+            const char* data;
+            {
+                ScopedPhase phase("unzip");
+                data = zip.read(*entries[i], &buf);
+                phase.setBytes(entries[i]->size);
+            }
+            MemIStream inf(data, entries[i]->size);
+            m.parse(inf, g_out);
+        }, outfile, out, numThreads);
+        return 0;
+    }
 
-    ObjMesh omesh(outfile);
+    string filename = dir + "/t_*.mesh";
 
     glob_t globbuf;
     glob(filename.c_str(), 0, NULL, &globbuf);
-    for(int i = 0; i < globbuf.gl_pathc; ++i)
-    {
-        filename = globbuf.gl_pathv[i];
-        cout << i << ", " << filename << ",   " << endl;
+    vector<string> files(globbuf.gl_pathv, globbuf.gl_pathv + globbuf.gl_pathc);
+    writeTilesObj(files, [&](size_t i, Mesh& m) {
+        m.parse(files[i], g_out);
+    }, outfile, out, numThreads);
+    return 0;
+}
 
-        Mesh m;
-        m.parse(filename, g_out);
-        m.exportObj(filename + ".obj");
+// imports an OBJ file as a .mesh and parses the result to check it
+int importObj(const string& objfile, const string& meshfile, ostream& out)
+{
+    ScopedProfileFile profileFile(objfile);
+    try {
+        ObjData obj;
+        {
+            ScopedPhase phase("parseObj");
+            readObjFile(objfile, obj);
+        }
+        string data = MeshBuilder::fromObj(obj);
+        writeFile(meshfile, data);
 
-        omesh.addFile(filename + ".obj");
+        Mesh m;
+        MemIStream inf(data.data(), data.size());
+        m.parse(inf, g_out);
+        out << "Corners=" << obj.corners.size() << "  VtxCount=" << m.countVtx() << "  Triangles=" << m.countTri()
+            << "  Submeshes=" << m.m_sub.size() << "  Size=" << data.size() << endl;
+    }
+    catch (const std::exception& e) {
+        out << "ERROR: " << e.what() << endl;
+        return 1;
     }
     return 0;
+}
 
+// converts between .mesh files and snapshots, parse takes both
+int convertSnapshot(const string& infile, const string& outfile, bool toSnapshot, ostream& out)
+{
+    ScopedProfileFile profileFile(infile);
+    try {
+        Mesh m;
+        m.parse(infile, g_out);
+        if (toSnapshot)
+            m.saveSnapshot(outfile);
+        else
+            m.save(outfile);
+        out << "VtxCount=" << m.countVtx() << "  Triangles=" << m.countTri() << endl;
+    }
+    catch (const std::exception& e) {
+        out << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
 }
 
 string fname(const string& s) {
@@ -150,13 +318,9 @@ int convertAllToObjec(const string& fromGlob, const string& outbase)
         string filename = globbuf.gl_pathv[i];
 
         string basename = fname(filename);
-        string unzpath = outbase + "/" + basename;
-        string cmd = "unzip " + filename + " -d " + unzpath;
-        //system( cmd.c_str() );
-
         string allfile = outbase + "/" + basename + "_at.obj";
 
-        convertToObj(unzpath, allfile);
+        convertToObj(filename, allfile, cout); // the zip is read directly
     }
 
     return 0;
@@ -173,8 +337,8 @@ int convertAllToObjec(const string& fromGlob, const string& outbase)
 
 
 
-int analyzer_main(const string& filename, const string& outdir);
-void printAnalyzeStats(const string& filename);
+int analyzer_main(const string& filename, const string& outdir, ResultCache& cache, ostream& out);
+int printAnalyzeStats(const string& filename, ostream& out);
 
 int main_print(const string& filename, bool allVtx)
 {
@@ -198,78 +362,367 @@ int main_print(const string& filename, bool allVtx)
 #define TR_REMOVE_TAN 0x08
 #define TR_ALL 0xFF
 
+#define TERRAIN_BATCH_VERTICES 65536 // merged tiles still fit 16 bit indices
 
-int main_terrainProcess(const string& dir, const string& outdir, int actions)
-{
-    string filename = dir + "/t_*.mesh";
 
+// processes one tile into outdata. the triangle counts are kept in the cache entry so that a hit doesn't need to parse anything.
+// progress goes to out, which is per tile since tiles are processed in parallel
+static void processTerrainTile(const string& filename, int actions, ResultCache& cache, const string& params,
+                               string* outdata, int* beforeTri, int* afterTri, ostream& out)
+{
     // most zoomed out eye direction and normal eye direction
-    vector<Vec3> eyes = { Vec3{-0.122788, -0.984808, -0.122788}, Vec3{-0.40558, -0.819152, -0.40558}, Vec3{-0.612372, -0.5, -0.612372} };
+    static const vector<Vec3> eyes = { Vec3{-0.122788, -0.984808, -0.122788}, Vec3{-0.40558, -0.819152, -0.40558}, Vec3{-0.612372, -0.5, -0.612372} };
+
+    ScopedProfileFile profileFile(filename);
+    string indata, cacheKey;
+    vector<int> triCounts;
+    CHECK(readFile(filename, &indata), "Failed reading file `" << filename << "`");
+    if (cache.enabled()) {
+        cacheKey = cache.makeKey(indata, params);
+        if (cache.get(cacheKey, outdata, &triCounts) && triCounts.size() == 2) {
+            *beforeTri = triCounts[0];
+            *afterTri = triCounts[1];
+            return;
+        }
+    }
+
+    Mesh m;
+    istringstream inf(indata);
+    m.parse(inf, g_out);
+    *beforeTri = m.countTri();
+    //m.removeDupTri();
+
+    if (actions & TR_CULL_BACK)
+        m.cullFaces(eyes, out);
+
+    if (actions & TR_UNIFY_QUADS)
+    {
+        auto heights = m.getPlaneHeights();
+        for(float h : heights)
+        {
+            QuadGrid grid;
+            if (!m.extractQuads(h, &grid, out))
+                continue; // not enough quads found
+            grid.solve(out);
+            m.replaceQuads(grid);
+        }
+    }
+
+    // remove unused vertices
+    if ((actions & TR_CULL_BACK) || (actions & TR_UNIFY_QUADS))
+    {
+        m.clearUsed();
+        m.markUsedVertices();
+        m.dedup();
+    }
+
+    if (actions & TR_REMOVE_DIFF) {
+        m.removeField(VES_DIFFUSE, 0);
+    }
+    if (actions & TR_REMOVE_TAN) {
+        m.removeField(VES_TANGENT, 0);
+    }
+
+    if ((actions & TR_REMOVE_DIFF) || (actions & TR_REMOVE_TAN))
+    {
+        m.dupsExact(); // mark exact vertex duplicates
+        m.dedup();
+    }
+
+    *afterTri = m.countTri();
 
+    m.serialize(outdata);
+    cache.put(cacheKey, *outdata, { *beforeTri, *afterTri });
+    //m.exportObj(filename + "_uni.obj");
+}
+
+// a tile of main_terrainProcess, filled by the worker that processes it
+struct TerrainTile {
     int beforeTri = 0, afterTri = 0;
+    string log; // printed in the order of the tiles
+    bool done = false;
+    exception_ptr error;
+};
+
+// the tiles are processed in parallel. when outdir is a .zip the results are added to that one archive
+// instead of a file for every tile, in the order of the tiles whichever finishes first
+int main_terrainProcess(const string& dir, const string& outdir, int actions, const string& cacheDir, int numThreads = 0)
+{
+    ResultCache cache(cacheDir);
+    stringstream params;
+    params << "terrainProcess actions=" << actions;
+    string filename = dir + "/t_*.mesh";
 
     glob_t globbuf;
     glob(filename.c_str(), 0, NULL, &globbuf);
-    for(int i = 0; i < globbuf.gl_pathc; ++i)
-    {
-        filename = globbuf.gl_pathv[i];
-        cout << i << ", " << filename << ",   " << endl;
+    vector<string> files(globbuf.gl_pathv, globbuf.gl_pathv + globbuf.gl_pathc);
 
-        Mesh m;
-        m.parse(filename, g_out);
-        beforeTri += m.countTri();
-        //m.removeDupTri();
+    unique_ptr<ZipWriter> zip;
+    if (outdir.size() > 4 && strcasecmp(outdir.c_str() + outdir.size() - 4, ".zip") == 0)
+        zip.reset(new ZipWriter(outdir, true));
 
-        if (actions & TR_CULL_BACK)
-            m.cullFaces(eyes);
+    vector<TerrainTile> tiles(files.size());
+    mutex tilesMutex;
+    condition_variable tileDone;
+    int beforeTri = 0, afterTri = 0;
+    {
+        WorkQueue queue(numThreads);
+        for(size_t i = 0; i < files.size(); ++i) {
+            queue.push([&, i](int) {
+                TerrainTile& tile = tiles[i];
+                exception_ptr error;
+                int thisBeforeTri = 0, thisAfterTri = 0;
+                ostringstream log;
+                try {
+                    string outdata;
+                    processTerrainTile(files[i], actions, cache, params.str(), &outdata, &thisBeforeTri, &thisAfterTri, log);
+                    if (zip)
+                        zip->add(i, fname(files[i]), outdata);
+                    else
+                        writeFile(outdir + basename(files[i]), outdata);
+                }
+                catch (...) {
+                    error = current_exception();
+                }
+                {
+                    lock_guard<mutex> lock(tilesMutex);
+                    tile.beforeTri = thisBeforeTri;
+                    tile.afterTri = thisAfterTri;
+                    tile.log = log.str();
+                    tile.error = error;
+                    tile.done = true;
+                }
+                tileDone.notify_all();
+            });
+        }
 
-        if (actions & TR_UNIFY_QUADS)
+        for(size_t i = 0; i < files.size(); ++i)
         {
-            auto heights = m.getPlaneHeights();
-            for(float h : heights)
+            exception_ptr error;
+            string log;
             {
-                QuadGrid grid;
-                if (!m.extractQuads(h, &grid))
-                    continue; // not enough quads found
-                grid.solve();
-                m.replaceQuads(grid);
+                unique_lock<mutex> lock(tilesMutex);
+                tileDone.wait(lock, [&]{ return tiles[i].done; });
+                error = tiles[i].error;
+                log.swap(tiles[i].log);
             }
+            cout << i << ", " << files[i] << ",   " << endl << log;
+            if (error)
+                rethrow_exception(error); // the queue goes first and waits for the jobs that use the tiles
+            beforeTri += tiles[i].beforeTri;
+            afterTri += tiles[i].afterTri;
         }
+    }
+    if (zip)
+        zip->close();
 
-        // remove unused vertices
-        if ((actions & TR_CULL_BACK) || (actions & TR_UNIFY_QUADS))
-        {
-            m.clearUsed();
-            m.markUsedVertices();
-            m.dedup();
-        }
+    cout << "TerrainProcess  " << afterTri << "/" << beforeTri << " = " << (float)afterTri / beforeTri*100.0 << "% triangles survived" << endl;
+    cache.printStats(cout);
 
-        if (actions & TR_REMOVE_DIFF) {
-            m.removeField(VES_DIFFUSE, 0);
-        }
-        if (actions & TR_REMOVE_TAN) {
-            m.removeField(VES_TANGENT, 0);
-        }
+    return 0;
 
-        if ((actions & TR_REMOVE_DIFF) || (actions & TR_REMOVE_TAN))
-        {
-            m.dupsExact(); // mark exact vertex duplicates
-            m.dedup();
-        }
+}
+
+// a tile of main_terrainBatch after it was processed
+struct BatchTile {
+    string data; // the processed mesh
+    MeshBounds bounds;
+    int numVtx = 0;
+    bool canBatch = false; // has bounds and can be appended to another mesh
+    int beforeTri = 0, afterTri = 0;
+    string log; // printed in the order of the tiles
+    exception_ptr error;
+};
+
+// a mesh of main_terrainBatch made of one or more tiles, filled by the worker that merges it
+struct BatchGroup {
+    string name;
+    int beforeVtx = 0, afterVtx = 0;
+    bool done = false;
+    exception_ptr error;
+};
+
+static float tileCenter(const MeshBounds& b, bool alongX) {
+    return alongX ? (b.min.x + b.max.x) * 0.5f : (b.min.z + b.max.z) * 0.5f;
+}
+
+// splits the tiles in two at the median of the horizontal axis their centers spread the most on, until the
+// vertices of every group fit in the budget. this keeps neighboring tiles in the same group
+static void groupTiles(const vector<BatchTile>& tiles, vector<size_t>::iterator begin, vector<size_t>::iterator end,
+                       int maxVertices, vector<vector<size_t>>* groups)
+{
+    long long numVtx = 0;
+    float minx = FLT_MAX, maxx = -FLT_MAX, minz = FLT_MAX, maxz = -FLT_MAX;
+    for(auto it = begin; it != end; ++it) {
+        const auto& tile = tiles[*it];
+        numVtx += tile.numVtx;
+        minx = min(minx, tileCenter(tile.bounds, true));
+        maxx = max(maxx, tileCenter(tile.bounds, true));
+        minz = min(minz, tileCenter(tile.bounds, false));
+        maxz = max(maxz, tileCenter(tile.bounds, false));
+    }
+    if (numVtx <= maxVertices || end - begin == 1) {
+        groups->push_back(vector<size_t>(begin, end));
+        return;
+    }
+    bool alongX = (maxx - minx >= maxz - minz);
+    auto mid = begin + (end - begin) / 2;
+    nth_element(begin, mid, end, [&](size_t a, size_t b) {
+        return tileCenter(tiles[a].bounds, alongX) < tileCenter(tiles[b].bounds, alongX);
+    });
+    groupTiles(tiles, begin, mid, maxVertices, groups);
+    groupTiles(tiles, mid, end, maxVertices, groups);
+}
 
+// processes the tiles like main_terrainProcess and then merges neighboring tiles to meshes of up to maxVertices
+// vertices so that the client draws a few big meshes instead of every tile. vertices that are the same in two
+// tiles, along their shared border, are welded. tiles that can't be merged are written by themselves.
+// both the tiles and the merged meshes are done in parallel
+int main_terrainBatch(const string& dir, const string& outdir, int actions, int maxVertices, const string& cacheDir, int numThreads = 0)
+{
+    ResultCache cache(cacheDir);
+    stringstream params;
+    params << "terrainProcess actions=" << actions; // the processed tiles are the same as terrainProcess gives
+    string filename = dir + "/t_*.mesh";
+
+    glob_t globbuf;
+    glob(filename.c_str(), 0, NULL, &globbuf);
+    vector<string> files(globbuf.gl_pathv, globbuf.gl_pathv + globbuf.gl_pathc);
 
-        afterTri += m.countTri();
+    unique_ptr<ZipWriter> zip;
+    if (outdir.size() > 4 && strcasecmp(outdir.c_str() + outdir.size() - 4, ".zip") == 0)
+        zip.reset(new ZipWriter(outdir, true));
 
-        string outfile = outdir + basename(filename);
-        m.save(outfile);
-        //m.exportObj(filename + "_uni.obj");
+    vector<BatchTile> tiles(files.size());
+    vector<vector<size_t>> groups;
+    vector<BatchGroup> results;
+    mutex resultsMutex;
+    condition_variable groupDone;
+    int beforeTri = 0, afterTri = 0;
+    long long beforeVtx = 0, afterVtx = 0;
+    {
+        WorkQueue queue(numThreads);
+        for(size_t i = 0; i < files.size(); ++i) {
+            queue.push([&, i](int) {
+                BatchTile& tile = tiles[i];
+                ostringstream log;
+                try {
+                    processTerrainTile(files[i], actions, cache, params.str(), &tile.data, &tile.beforeTri, &tile.afterTri, log);
+                    Mesh m;
+                    MemIStream inf(tile.data.data(), tile.data.size());
+                    m.parse(inf, g_out);
+                    tile.numVtx = m.countVtx();
+                    tile.canBatch = m.isAppendable() && m.getBounds(&tile.bounds);
+                }
+                catch (...) {
+                    tile.error = current_exception();
+                }
+                tile.log = log.str();
+            });
+        }
+        queue.wait();
+
+        vector<size_t> batched;
+        for(size_t i = 0; i < files.size(); ++i) {
+            cout << i << ", " << files[i] << ",   " << endl << tiles[i].log;
+            if (tiles[i].error)
+                rethrow_exception(tiles[i].error);
+            beforeTri += tiles[i].beforeTri;
+            afterTri += tiles[i].afterTri;
+            if (tiles[i].canBatch)
+                batched.push_back(i);
+            else
+                groups.push_back({ i });
+        }
+        groupTiles(tiles, batched.begin(), batched.end(), maxVertices, &groups);
+        // in the order of the files so the output doesn't depend on how the groups were split
+        for(auto& group: groups)
+            sort(group.begin(), group.end());
+        sort(groups.begin(), groups.end());
+
+        results.resize(groups.size());
+        for(size_t g = 0; g < groups.size(); ++g) {
+            queue.push([&, g](int) {
+                const auto& group = groups[g];
+                // a tile by itself keeps its name
+                string name = (group.size() == 1) ? fname(files[group[0]]) : "batch_" + to_string(g) + ".mesh";
+                ScopedProfileFile profileFile(name);
+                exception_ptr error;
+                int thisBeforeVtx = 0, thisAfterVtx = 0;
+                try {
+                    string outdata;
+                    if (group.size() == 1) {
+                        outdata.swap(tiles[group[0]].data);
+                        thisBeforeVtx = thisAfterVtx = tiles[group[0]].numVtx;
+                    }
+                    else {
+                        Mesh m;
+                        for(size_t i: group) {
+                            Mesh tm;
+                            MemIStream inf(tiles[i].data.data(), tiles[i].data.size());
+                            Mesh& target = (i == group[0]) ? m : tm;
+                            target.parse(inf, g_out);
+                            string().swap(tiles[i].data);
+                            if (i != group[0])
+                                m.append(tm);
+                        }
+                        thisBeforeVtx = m.countVtx();
+                        {
+                            ScopedPhase phase("weld");
+                            m.dupsExact();
+                            m.dedup();
+                        }
+                        thisAfterVtx = m.countVtx();
+                        m.serialize(&outdata);
+                    }
+                    if (zip)
+                        zip->add(g, name, outdata);
+                    else
+                        writeFile(outdir + "/" + name, outdata);
+                }
+                catch (...) {
+                    error = current_exception();
+                }
+                {
+                    lock_guard<mutex> lock(resultsMutex);
+                    auto& res = results[g];
+                    res.name = name;
+                    res.beforeVtx = thisBeforeVtx;
+                    res.afterVtx = thisAfterVtx;
+                    res.error = error;
+                    res.done = true;
+                }
+                groupDone.notify_all();
+            });
+        }
 
+        for(size_t g = 0; g < groups.size(); ++g)
+        {
+            BatchGroup res;
+            {
+                unique_lock<mutex> lock(resultsMutex);
+                groupDone.wait(lock, [&]{ return results[g].done; });
+                res = results[g];
+            }
+            cout << g << ", " << res.name << ",   " << groups[g].size() << " tiles  " << res.afterVtx << "/" << res.beforeVtx << " vertices" << endl;
+            if (groups[g].size() > 1) {
+                for(size_t i: groups[g])
+                    cout << "    " << files[i] << endl;
+            }
+            if (res.error)
+                rethrow_exception(res.error); // the queue goes first and waits for the jobs that use the groups
+            beforeVtx += res.beforeVtx;
+            afterVtx += res.afterVtx;
+        }
     }
+    if (zip)
+        zip->close();
 
     cout << "TerrainProcess  " << afterTri << "/" << beforeTri << " = " << (float)afterTri / beforeTri*100.0 << "% triangles survived" << endl;
+    cout << "TerrainBatch  " << files.size() << " tiles in " << groups.size() << " meshes, " << afterVtx << "/" << beforeVtx << " vertices after welding" << endl;
+    cache.printStats(cout);
 
     return 0;
-
 }
 
 
@@ -287,7 +740,7 @@ int main_dirStats(string filename)
         {
             filename = globbuf.gl_pathv[i];
 
-            printAnalyzeStats(filename);
+            printAnalyzeStats(filename, cout);
 
         }
     }
@@ -299,25 +752,79 @@ int main_dirStats(string filename)
 }
 
 
-// command line inspector
-int main(int argc, char* argv[])
+// a job sent to the server, the same commands as the command line
+bool runServerJob(const vector<string>& args, ostream& out, ResultCache& cache)
+{
+    if (args.size() == 3 && strcasecmp(args[0].c_str(), "optimize") == 0)
+        return analyzer_main(args[1], args[2], cache, out) == 0;
+    if (args.size() == 2 && strcasecmp(args[0].c_str(), "stats") == 0)
+        return printAnalyzeStats(args[1], out) == 0;
+    if (args.size() == 3 && strcasecmp(args[0].c_str(), "toobj") == 0)
+        return convertToObj(args[1], args[2], out, 1) == 0; // the server already runs jobs in parallel
+    if (args.size() == 3 && strcasecmp(args[0].c_str(), "mergeobj") == 0)
+        return unifyObjs(args[1], args[2], out) == 0;
+    if (args.size() == 3 && strcasecmp(args[0].c_str(), "fromobj") == 0)
+        return importObj(args[1], args[2], out) == 0;
+    if (args.size() == 3 && (strcasecmp(args[0].c_str(), "tosnap") == 0 || strcasecmp(args[0].c_str(), "fromsnap") == 0))
+        return convertSnapshot(args[1], args[2], strcasecmp(args[0].c_str(), "tosnap") == 0, out) == 0;
+    out << "Unknown job `" << (args.empty() ? "" : args[0]) << "` with " << args.size() << " arguments" << endl;
+    return false;
+}
+
+int main_serve(const string& socketPath, int numThreads, const string& cacheDir)
+{
+    try {
+        // one cache for all the jobs, the totals are printed when the server stops
+        ResultCache cache(cacheDir);
+        int ret = serve(socketPath, numThreads, [&cache](const vector<string>& args, ostream& out) {
+            return runServerJob(args, out, cache);
+        });
+        cache.printStats(cout);
+        return ret;
+    }
+    catch (const std::exception& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return 1;
+    }
+}
+
+int run_command(int argc, char* argv[])
 {
     if (argc < 2) {
-        cout << "Usage: ogre_format print <filename.mesh> [allvtx]\n" <<
-                "       ogre_format optimize <filename.mesh> <output-folder>\n"
-                "       ogre_format toobj <from-mission-dir> <to-file.obj>\n"
-                "       ogre_format terrainProcess <in-dir> <out-dir>\n"
+        cout << "Usage: ogre_format [-profile <out.jsonl>] <command>\n"
+                "       ogre_format print <filename.mesh> [allvtx]\n" <<
+                "       ogre_format optimize <filename.mesh> <output-folder> [cache-dir]\n"
+                "       ogre_format toobj <from-mission-dir-or-zip> <to-file.obj>\n"
+                "       ogre_format mergeobj <from-dir> <to-file.obj>\n"
+                "       ogre_format fromobj <from-file.obj> <to-file.mesh>\n"
+                "       ogre_format tosnap <from-file.mesh> <to-file.snap>\n"
+                "       ogre_format fromsnap <from-file.snap> <to-file.mesh>\n"
+                "       ogre_format terrainProcess <in-dir> <out-dir-or-zip> [cache-dir]\n"
+                "       ogre_format terrainBatch <in-dir> <out-dir-or-zip> [max-vertices] [cache-dir]\n"
+                "       ogre_format serve <socket-path> [threads] [cache-dir]\n"
                         << endl;
         return 1;
     }
 
     string argv1 = argv[1];
     if (argc == 4 && strcasecmp(argv[1], "toobj") == 0) {
-        return convertToObj(argv[2], argv[3]);
+        return convertToObj(argv[2], argv[3], cout);
+    }
+    if (argc == 4 && strcasecmp(argv[1], "mergeobj") == 0) {
+        return unifyObjs(argv[2], argv[3], cout);
+    }
+    if (argc == 4 && strcasecmp(argv[1], "fromobj") == 0) {
+        return importObj(argv[2], argv[3], cout);
+    }
+    if (argc == 4 && (strcasecmp(argv[1], "tosnap") == 0 || strcasecmp(argv[1], "fromsnap") == 0)) {
+        return convertSnapshot(argv[2], argv[3], strcasecmp(argv[1], "tosnap") == 0, cout);
     }
 
-    if (argc == 4 && strcasecmp(argv[1], "optimize") == 0) {
-        return analyzer_main(argv[2], argv[3]);
+    if ((argc == 4 || argc == 5) && strcasecmp(argv[1], "optimize") == 0) {
+        ResultCache cache((argc == 5) ? argv[4] : "");
+        int ret = analyzer_main(argv[2], argv[3], cache, cout);
+        cache.printStats(cout);
+        return ret;
     }
 
     if (argc >= 3 && strcasecmp(argv[1], "print") == 0) {
@@ -328,12 +835,47 @@ int main(int argc, char* argv[])
     }
 
     if (argc >= 4 && strcasecmp(argv[1], "terrainProcess") == 0) {
-        return main_terrainProcess(argv[2], argv[3], TR_ALL);
+        return main_terrainProcess(argv[2], argv[3], TR_ALL, (argc >= 5) ? argv[4] : "");
+    }
+
+    if (argc >= 4 && strcasecmp(argv[1], "terrainBatch") == 0) {
+        int maxVertices = (argc >= 5) ? atoi(argv[4]) : TERRAIN_BATCH_VERTICES;
+        if (maxVertices <= 0) {
+            cerr << "ERROR: Bad vertex budget `" << argv[4] << "`" << endl;
+            return 1;
+        }
+        return main_terrainBatch(argv[2], argv[3], TR_ALL, maxVertices, (argc >= 6) ? argv[5] : "");
+    }
+
+    if (argc >= 3 && strcasecmp(argv[1], "serve") == 0) {
+        return main_serve(argv[2], (argc >= 4) ? atoi(argv[3]) : 0, (argc >= 5) ? argv[4] : "");
     }
 
 
     return main_dirStats(argv[1]);
 };
 
+// command line inspector
+int main(int argc, char* argv[])
+{
+    // per file phase timings as JSON lines, followed by a line with the totals
+    ofstream profileOut;
+    if (argc >= 3 && strcasecmp(argv[1], "-profile") == 0) {
+        profileOut.open(argv[2]);
+        if (!profileOut.good()) {
+            cerr << "ERROR: Failed opening profile output `" << argv[2] << "`" << endl;
+            return 1;
+        }
+        Profile::setOutput(&profileOut);
+        argc -= 2;
+        argv += 2;
+    }
+
+    int ret = run_command(argc, argv);
+    Profile::writeTotals();
+    Profile::setOutput(nullptr);
+    return ret;
+}
+
 
 
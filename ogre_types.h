@@ -68,6 +68,29 @@ inline int typeSize(ushort type) { // in bytes
     throw Exception("unknown type with unknown size");
 }
 
+// the size of the values the type is made of, what its bytes are reversed by in a file of the other byte order.
+// packed colours are one 32 bit value
+inline int componentSize(ushort type) {
+    switch(type) {
+    case VET_FLOAT1:
+    case VET_FLOAT2:
+    case VET_FLOAT3:
+    case VET_FLOAT4:
+    case VET_COLOUR:
+    case VET_COLOUR_ARGB:
+    case VET_COLOUR_ABGR:
+        return 4;
+    case VET_SHORT1:
+    case VET_SHORT2:
+    case VET_SHORT3:
+    case VET_SHORT4:
+        return 2;
+    case VET_UBYTE4:
+        return 1;
+    }
+    throw Exception("unknown type with unknown size");
+}
+
 /// Vertex element semantics, used to identify the meaning of vertex buffer contents
 enum VertexElementSemantic {
 /// Position, 3 reals per vertex